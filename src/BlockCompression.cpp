@@ -0,0 +1,360 @@
+#include "BlockCompression.h"
+#include "ImageCache.h"
+#include "ImageDecoder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <random>
+
+namespace
+{
+	uint16_t to565(const float colour[3])
+	{
+		auto quantize = [](float value, int levels) {
+			return std::clamp((int)std::lround(value * levels / 255.f), 0, levels);
+		};
+		return (uint16_t)((quantize(colour[0], 31) << 11) | (quantize(colour[1], 63) << 5) | quantize(colour[2], 31));
+	}
+
+	void from565(uint16_t packed, int colour[3])
+	{
+		int r = (packed >> 11) & 31;
+		int g = (packed >> 5) & 63;
+		int b = packed & 31;
+		colour[0] = (r << 3) | (r >> 2);
+		colour[1] = (g << 2) | (g >> 4);
+		colour[2] = (b << 3) | (b >> 2);
+	}
+
+	//First endpoint above the second selects the four colour palette, otherwise it is three colours and black
+	void palette(uint16_t first, uint16_t second, int colours[4][3])
+	{
+		from565(first, colours[0]);
+		from565(second, colours[1]);
+		for (int c = 0; c < 3; ++c)
+		{
+			if (first > second)
+			{
+				colours[2][c] = (2 * colours[0][c] + colours[1][c]) / 3;
+				colours[3][c] = (colours[0][c] + 2 * colours[1][c]) / 3;
+			}
+			else
+			{
+				colours[2][c] = (colours[0][c] + colours[1][c]) / 2;
+				colours[3][c] = 0;
+			}
+		}
+	}
+
+	//Nearest palette entry for every pixel, returns the summed squared error
+	uint32_t assign(const int pixels[16][3], const int colours[4][3], uint32_t& indices)
+	{
+		uint32_t error = 0;
+		indices = 0;
+		for (int i = 0; i < 16; ++i)
+		{
+			uint32_t best = UINT32_MAX;
+			uint32_t bestIndex = 0;
+			for (uint32_t p = 0; p < 4; ++p)
+			{
+				int dr = pixels[i][0] - colours[p][0];
+				int dg = pixels[i][1] - colours[p][1];
+				int db = pixels[i][2] - colours[p][2];
+				uint32_t distance = (uint32_t)(dr * dr + dg * dg + db * db);
+				if (distance < best)
+				{
+					best = distance;
+					bestIndex = p;
+				}
+			}
+			error += best;
+			indices |= bestIndex << (i * 2);
+		}
+		return error;
+	}
+
+	void writeBlock(unsigned char* block, uint16_t first, uint16_t second, uint32_t indices)
+	{
+		block[0] = (unsigned char)(first & 0xff);
+		block[1] = (unsigned char)(first >> 8);
+		block[2] = (unsigned char)(second & 0xff);
+		block[3] = (unsigned char)(second >> 8);
+		for (int i = 0; i < 4; ++i)
+			block[4 + i] = (unsigned char)(indices >> (i * 8));
+	}
+
+	void encodeBlock(const int pixels[16][3], unsigned char* block)
+	{
+		float mean[3] = {};
+		for (int i = 0; i < 16; ++i)
+		{
+			for (int c = 0; c < 3; ++c)
+				mean[c] += pixels[i][c] / 16.f;
+		}
+
+		float covariance[3][3] = {};
+		for (int i = 0; i < 16; ++i)
+		{
+			float d[3] = { pixels[i][0] - mean[0], pixels[i][1] - mean[1], pixels[i][2] - mean[2] };
+			for (int a = 0; a < 3; ++a)
+			{
+				for (int b = 0; b < 3; ++b)
+					covariance[a][b] += d[a] * d[b];
+			}
+		}
+
+		//principal axis by power iteration, starting from the luminance direction
+		float axis[3] = { .3f, .6f, .1f };
+		for (int iteration = 0; iteration < 8; ++iteration)
+		{
+			float next[3];
+			for (int a = 0; a < 3; ++a)
+				next[a] = covariance[a][0] * axis[0] + covariance[a][1] * axis[1] + covariance[a][2] * axis[2];
+			float length = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+			if (length < 1e-6f)
+				break;
+			for (int a = 0; a < 3; ++a)
+				axis[a] = next[a] / length;
+		}
+
+		float lowest = INFINITY;
+		float highest = -INFINITY;
+		for (int i = 0; i < 16; ++i)
+		{
+			float projection = (pixels[i][0] - mean[0]) * axis[0] + (pixels[i][1] - mean[1]) * axis[1] + (pixels[i][2] - mean[2]) * axis[2];
+			lowest = std::min(lowest, projection);
+			highest = std::max(highest, projection);
+		}
+
+		//endpoints pulled in by 1/16 of the range, the extremes are rarely worth a palette entry each
+		float inset = (highest - lowest) / 16.f;
+		float ends[2][3];
+		for (int c = 0; c < 3; ++c)
+		{
+			ends[0][c] = std::clamp(mean[c] + (highest - inset) * axis[c], 0.f, 255.f);
+			ends[1][c] = std::clamp(mean[c] + (lowest + inset) * axis[c], 0.f, 255.f);
+		}
+
+		uint32_t bestError = UINT32_MAX;
+		for (int refinement = 0; refinement < 3; ++refinement)
+		{
+			uint16_t first = to565(ends[0]);
+			uint16_t second = to565(ends[1]);
+			if (first < second)
+			{
+				std::swap(first, second);
+				std::swap(ends[0], ends[1]);
+			}
+
+			int colours[4][3];
+			palette(first, second, colours);
+			uint32_t indices = 0;
+			uint32_t error = 0;
+			if (first == second)
+			{
+				//one colour, every pixel takes entry 0 (entry 3 of the three colour palette is black)
+				for (int i = 0; i < 16; ++i)
+				{
+					for (int c = 0; c < 3; ++c)
+						error += (uint32_t)((pixels[i][c] - colours[0][c]) * (pixels[i][c] - colours[0][c]));
+				}
+			}
+			else
+			{
+				error = assign(pixels, colours, indices);
+			}
+
+			if (error < bestError)
+			{
+				bestError = error;
+				writeBlock(block, first, second, indices);
+			}
+			if (error == 0 || first == second)
+				break;
+
+			//least squares endpoints for the current indices, each pixel a fixed blend of the two
+			constexpr float weights[4] = { 1.f, 0.f, 2.f / 3.f, 1.f / 3.f };
+			float aa = 0.f, bb = 0.f, ab = 0.f;
+			float ax[3] = {}, bx[3] = {};
+			for (int i = 0; i < 16; ++i)
+			{
+				float w = weights[(indices >> (i * 2)) & 3];
+				aa += w * w;
+				bb += (1.f - w) * (1.f - w);
+				ab += w * (1.f - w);
+				for (int c = 0; c < 3; ++c)
+				{
+					ax[c] += w * pixels[i][c];
+					bx[c] += (1.f - w) * pixels[i][c];
+				}
+			}
+			float determinant = aa * bb - ab * ab;
+			if (std::fabs(determinant) < 1e-6f)
+				break;
+			for (int c = 0; c < 3; ++c)
+			{
+				ends[0][c] = std::clamp((ax[c] * bb - bx[c] * ab) / determinant, 0.f, 255.f);
+				ends[1][c] = std::clamp((bx[c] * aa - ax[c] * ab) / determinant, 0.f, 255.f);
+			}
+		}
+	}
+}
+
+namespace
+{
+	//Tile sized stand-ins for artwork: smooth gradients, hard edged shapes and grain
+	DecodedImage syntheticImage(uint32_t seed)
+	{
+		DecodedImage image;
+		image.width = image.textureWidth = image.sourceWidth = 512;
+		image.height = image.textureHeight = image.sourceHeight = 288;
+		image.pixels.reset(new unsigned char[(size_t)image.width * image.height * 4]);
+		std::mt19937 random(seed);
+		std::uniform_int_distribution<int> grain(-6, 6);
+		for (uint32_t y = 0; y < image.height; ++y)
+		{
+			for (uint32_t x = 0; x < image.width; ++x)
+			{
+				unsigned char* pixel = image.pixels.get() + ((size_t)y * image.width + x) * 4;
+				bool shape = ((x / 64 + y / 48 + seed) % 5) == 0;
+				int base[3] = { (int)(x * 255 / image.width), (int)(y * 255 / image.height), (int)((x + y + seed * 40) % 256) };
+				for (int c = 0; c < 3; ++c)
+					pixel[c] = (unsigned char)std::clamp((shape ? 255 - base[c] : base[c]) + grain(random), 0, 255);
+				pixel[3] = 255;
+			}
+		}
+		return image;
+	}
+
+	bool loadImage(const std::string& file, DecodedImage& image)
+	{
+		std::ifstream in(file, std::ios::binary);
+		std::vector<unsigned char> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		return !data.empty() && decodeImage(data.data(), data.size(), 0, 0, image);
+	}
+}
+
+size_t bc1Size(uint32_t width, uint32_t height)
+{
+	return (size_t)((width + 3) / 4) * ((height + 3) / 4) * 8;
+}
+
+void encodeBC1(const unsigned char* rgba, uint32_t width, uint32_t height, unsigned char* blocks)
+{
+	for (uint32_t by = 0; by < height; by += 4)
+	{
+		for (uint32_t bx = 0; bx < width; bx += 4, blocks += 8)
+		{
+			int pixels[16][3];
+			for (uint32_t y = 0; y < 4; ++y)
+			{
+				const unsigned char* row = rgba + (size_t)std::min(by + y, height - 1) * width * 4;
+				for (uint32_t x = 0; x < 4; ++x)
+				{
+					const unsigned char* pixel = row + (size_t)std::min(bx + x, width - 1) * 4;
+					for (int c = 0; c < 3; ++c)
+						pixels[y * 4 + x][c] = pixel[c];
+				}
+			}
+			encodeBlock(pixels, blocks);
+		}
+	}
+}
+
+void decodeBC1(const unsigned char* blocks, uint32_t width, uint32_t height, unsigned char* rgba)
+{
+	for (uint32_t by = 0; by < height; by += 4)
+	{
+		for (uint32_t bx = 0; bx < width; bx += 4, blocks += 8)
+		{
+			uint16_t first = (uint16_t)(blocks[0] | (blocks[1] << 8));
+			uint16_t second = (uint16_t)(blocks[2] | (blocks[3] << 8));
+			uint32_t indices = (uint32_t)blocks[4] | ((uint32_t)blocks[5] << 8) | ((uint32_t)blocks[6] << 16) | ((uint32_t)blocks[7] << 24);
+			int colours[4][3];
+			palette(first, second, colours);
+			for (uint32_t y = 0; y < 4 && by + y < height; ++y)
+			{
+				unsigned char* row = rgba + ((size_t)(by + y) * width + bx) * 4;
+				for (uint32_t x = 0; x < 4 && bx + x < width; ++x, row += 4)
+				{
+					const int* colour = colours[(indices >> ((y * 4 + x) * 2)) & 3];
+					row[0] = (unsigned char)colour[0];
+					row[1] = (unsigned char)colour[1];
+					row[2] = (unsigned char)colour[2];
+					row[3] = 255;
+				}
+			}
+		}
+	}
+}
+
+void benchmarkBC1(const std::vector<std::string>& files, std::ostream& os)
+{
+	std::vector<DecodedImage> images;
+	for (auto&& file : files)
+	{
+		DecodedImage image;
+		if (loadImage(file, image))
+			images.push_back(std::move(image));
+		else
+			os << "BC1 benchmark: could not decode " << file << std::endl;
+	}
+	if (files.empty())
+	{
+		for (uint32_t seed = 0; seed < 8; ++seed)
+			images.push_back(syntheticImage(seed));
+	}
+	if (images.empty())
+		return;
+
+	using clock = std::chrono::steady_clock;
+	constexpr int passes = 3;
+	double encodeSeconds = 0.0;
+	double decodeSeconds = 0.0;
+	double squaredError = 0.0;
+	double worstPsnr = 1e9;
+	size_t sourceBytes = 0;
+	size_t compressedBytes = 0;
+	for (auto&& image : images)
+	{
+		size_t pixels = (size_t)image.width * image.height;
+		std::vector<unsigned char> blocks(bc1Size(image.width, image.height));
+		std::vector<unsigned char> decoded(pixels * 4);
+		for (int pass = 0; pass < passes; ++pass)
+		{
+			auto begin = clock::now();
+			encodeBC1(image.pixels.get(), image.width, image.height, blocks.data());
+			auto encoded = clock::now();
+			decodeBC1(blocks.data(), image.width, image.height, decoded.data());
+			encodeSeconds += std::chrono::duration<double>(encoded - begin).count();
+			decodeSeconds += std::chrono::duration<double>(clock::now() - encoded).count();
+		}
+
+		//colour channels only, BC1 here is always opaque
+		double error = 0.0;
+		for (size_t i = 0; i < pixels * 4; ++i)
+		{
+			if (i % 4 == 3)
+				continue;
+			double difference = (double)image.pixels[i] - (double)decoded[i];
+			error += difference * difference;
+		}
+		squaredError += error;
+		double meanError = error / (double)(pixels * 3);
+		worstPsnr = std::min(worstPsnr, meanError > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / meanError) : 99.0);
+		sourceBytes += pixels * 4;
+		compressedBytes += blocks.size();
+	}
+
+	double meanError = squaredError / (double)(sourceBytes / 4 * 3);
+	double megabytes = (double)sourceBytes * passes / (1024.0 * 1024.0);
+	os << "BC1 benchmark: " << images.size() << (files.empty() ? " synthetic" : "") << " images, "
+		<< sourceBytes << " RGBA bytes to " << compressedBytes << " compressed" << std::endl;
+	os << "BC1 quality: PSNR " << (meanError > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / meanError) : 99.0) << " dB overall, "
+		<< worstPsnr << " dB worst image" << std::endl;
+	os << "BC1 throughput: encode " << megabytes / encodeSeconds << " MB/s, decode " << megabytes / decodeSeconds << " MB/s" << std::endl;
+}
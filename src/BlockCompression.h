@@ -0,0 +1,25 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+//BC1 (DXT1) block compression of opaque RGBA: each 4x4 block becomes two RGB565 endpoints and
+//sixteen 2 bit palette indices, 8 bytes for what took 64.  Images whose size is not a multiple
+//of 4 are padded by repeating their last row and column.
+enum class TextureCompression
+{
+	None,
+	BC1,
+};
+
+size_t bc1Size(uint32_t width, uint32_t height);
+
+//Endpoints are fitted along the block's principal colour axis, then refined by least squares
+void encodeBC1(const unsigned char* rgba, uint32_t width, uint32_t height, unsigned char* blocks);
+void decodeBC1(const unsigned char* blocks, uint32_t width, uint32_t height, unsigned char* rgba);
+
+//CPU only quality and throughput check of the encoder: each image (decoded at full size, or a synthetic
+//set when there are none) is encoded, decoded back and compared, reporting PSNR and MB/s of RGBA in
+void benchmarkBC1(const std::vector<std::string>& files, std::ostream& os);
@@ -0,0 +1,395 @@
+#include "CatalogParser.h"
+#include "TileManager.h"
+#include "ImageCache.h"
+#include "ImageVariant.h"
+#include <nlohmann/json.hpp>
+#include "Stats.h"
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+namespace
+{
+	constexpr const char* RefPrefix = "https://cd-static.bamgrid.com/dp-117731241344/sets/";
+
+	constexpr std::string_view RowClassName = "CuratedSet";
+	constexpr std::string_view RowClassNameTrending = "TrendingSet";
+	constexpr std::string_view RowClassNamePersonalized = "PersonalizedCuratedSet";
+	constexpr std::string_view RowClassNameRefSet = "SetRef";
+	constexpr std::string_view SeriesClassName = "DmcSeries";
+	constexpr std::string_view VideoClassName = "DmcVideo";
+	constexpr std::string_view CollectionClassName = "StandardCollection";
+
+	struct TextField
+	{
+		std::string kind;
+		std::string content;
+		std::string language;
+	};
+
+	//Fields of one JSON object that the grid cares about, captured whatever order its keys arrive in
+	struct Frame
+	{
+		std::string type;
+		std::string refId;
+		std::string contentId;
+		std::string rating;
+		bool hasContainers = false;
+		std::vector<TextField> titles;
+		std::vector<ImageVariant> images;
+		std::vector<Tile> tiles;
+
+		TextField* title(std::string_view kind)
+		{
+			for (auto&& title : titles)
+			{
+				if (title.kind == kind)
+					return &title;
+			}
+			return nullptr;
+		}
+
+		TextField& titleFor(const std::string& kind)
+		{
+			if (auto existing = title(kind))
+				return *existing;
+			titles.push_back({ kind, {}, {} });
+			return titles.back();
+		}
+
+		ImageVariant& imageFor(const std::string& aspectRatio, const std::string& kind)
+		{
+			for (auto&& image : images)
+			{
+				if (image.aspectRatio == aspectRatio && image.kind == kind)
+					return image;
+			}
+			images.push_back({ aspectRatio, kind, {}, 0, 0 });
+			return images.back();
+		}
+
+		std::string imageUrl(std::string_view kind) const
+		{
+			uint32_t targetWidth = 0;
+			uint32_t targetHeight = 0;
+			ImageCache::instance().targetSize(targetWidth, targetHeight);
+			auto best = selectImageVariant(images, kind, targetWidth, targetHeight);
+			return best ? best->url : std::string();
+		}
+
+		bool isSet() const
+		{
+			return type == RowClassName || type == RowClassNameTrending || type == RowClassNamePersonalized;
+		}
+	};
+
+	struct PathElement
+	{
+		bool isArray = false;
+		int index = -1;
+		int frame = -1;
+		std::string key;
+	};
+
+	class CatalogHandler : public nlohmann::json_sax<nlohmann::json>
+	{
+	public:
+		explicit CatalogHandler(const RowSink& sink) : _sink(sink) {}
+
+		bool null() override { beginValue(); return true; }
+		bool boolean(bool) override { beginValue(); return true; }
+		bool number_integer(number_integer_t val) override { beginValue(); captureNumber(val); return true; }
+		bool number_unsigned(number_unsigned_t val) override { beginValue(); captureNumber(val); return true; }
+		bool number_float(number_float_t, const string_t&) override { beginValue(); return true; }
+		bool binary(binary_t&) override { beginValue(); return true; }
+
+		bool string(string_t& val) override
+		{
+			beginValue();
+			capture(val);
+			return true;
+		}
+
+		bool start_object(std::size_t) override
+		{
+			beginValue();
+			_frames.emplace_back();
+			_path.push_back({ false, -1, (int)_frames.size() - 1, {} });
+			return true;
+		}
+
+		bool key(string_t& val) override
+		{
+			_path.back().key = val;
+			if (val == "containers")
+				_frames.back().hasContainers = true;
+			return true;
+		}
+
+		bool end_object() override
+		{
+			_path.pop_back();
+			Frame frame = std::move(_frames.back());
+			_frames.pop_back();
+			finish(std::move(frame));
+			return true;
+		}
+
+		bool start_array(std::size_t) override
+		{
+			beginValue();
+			_path.push_back({ true, -1, -1, {} });
+			return true;
+		}
+
+		bool end_array() override
+		{
+			_path.pop_back();
+			return true;
+		}
+
+		bool parse_error(std::size_t position, const std::string&, const nlohmann::detail::exception& ex) override
+		{
+			std::cerr << "Catalog parse error at " << position << ": " << ex.what() << std::endl;
+			return false;
+		}
+
+	private:
+		void beginValue()
+		{
+			if (!_path.empty() && _path.back().isArray)
+				_path.back().index++;
+		}
+
+		//Element `depth` levels above the current value, as long as it is an object's key
+		const PathElement* keyAt(size_t depth) const
+		{
+			if (depth > _path.size())
+				return nullptr;
+			const auto& element = _path[_path.size() - depth];
+			return element.isArray ? nullptr : &element;
+		}
+
+		void capture(const std::string& value)
+		{
+			//"type", "refId", "contentId" ("collectionId" for collections)
+			if (auto owner = keyAt(1))
+			{
+				auto& frame = _frames[owner->frame];
+				if (owner->key == "type")
+					frame.type = value;
+				else if (owner->key == "refId")
+					frame.refId = value;
+				else if (owner->key == "contentId" || (owner->key == "collectionId" && frame.contentId.empty()))
+					frame.contentId = value;
+			}
+
+			//ratings[0].value
+			if (auto owner = keyAt(3); owner && owner->key == "ratings")
+			{
+				const auto& index = _path[_path.size() - 2];
+				if (index.isArray && index.index == 0 && _path.back().key == "value")
+					_frames[owner->frame].rating = value;
+			}
+
+			//text.title.full.<kind>.default.(content|language)
+			if (auto owner = fieldAt6("text", "title"); owner && _path[_path.size() - 4].key == "full")
+			{
+				auto& title = _frames[owner->frame].titleFor(_path[_path.size() - 3].key);
+				if (_path.back().key == "content")
+					title.content = value;
+				else if (_path.back().key == "language")
+					title.language = value;
+			}
+
+			//image.tile.<ratio>.<kind>.default.url
+			if (auto image = imageVariant(); image && _path.back().key == "url")
+				image->url = value;
+		}
+
+		void captureNumber(int64_t value)
+		{
+			//image.tile.<ratio>.<kind>.default.(masterWidth|masterHeight)
+			auto image = imageVariant();
+			if (!image || value < 0)
+				return;
+			if (_path.back().key == "masterWidth")
+				image->masterWidth = (uint32_t)value;
+			else if (_path.back().key == "masterHeight")
+				image->masterHeight = (uint32_t)value;
+		}
+
+		//Object six levels up when it is `first`.`second`.*.*.default with no arrays in between
+		const PathElement* fieldAt6(std::string_view first, std::string_view second) const
+		{
+			auto owner = keyAt(6);
+			if (!owner || owner->key != first)
+				return nullptr;
+			for (size_t i = _path.size() - 5; i < _path.size(); ++i)
+			{
+				if (_path[i].isArray)
+					return nullptr;
+			}
+			if (_path[_path.size() - 5].key != second || _path[_path.size() - 2].key != "default")
+				return nullptr;
+			return owner;
+		}
+
+		ImageVariant* imageVariant()
+		{
+			auto owner = fieldAt6("image", "tile");
+			if (!owner)
+				return nullptr;
+			return &_frames[owner->frame].imageFor(_path[_path.size() - 4].key, _path[_path.size() - 3].key);
+		}
+
+		void finish(Frame&& frame)
+		{
+			if (frame.isSet() || frame.type == RowClassNameRefSet)
+			{
+				Row row;
+				if (auto title = frame.title("set"))
+					row.title = title->content;
+				if (frame.type == RowClassNameRefSet)
+				{
+					row.isRefSet = true;
+					row.setId = std::string(RefPrefix) + frame.refId + ".json";
+				}
+				row._tiles = std::move(frame.tiles);
+				_sink(std::move(row));
+				return;
+			}
+
+			if (frame.type == SeriesClassName)
+				addTile(frame, "series", TileData::Type::Series);
+			else if (frame.type == VideoClassName)
+				addTile(frame, "program", TileData::Type::Movie);
+			else if (frame.type == CollectionClassName && !frame.hasContainers)
+				addTile(frame, "collection", TileData::Type::Collection);
+
+			//tiles belong to the closest enclosing set
+			if (!_frames.empty() && !frame.tiles.empty())
+			{
+				auto& parent = _frames.back().tiles;
+				parent.insert(parent.end(), std::make_move_iterator(frame.tiles.begin()), std::make_move_iterator(frame.tiles.end()));
+			}
+		}
+
+		void addTile(Frame& frame, std::string_view kind, TileData::Type type)
+		{
+			Tile tile;
+			if (auto title = frame.title(kind))
+			{
+				tile.data().setTitle(title->content);
+				if (type != TileData::Type::Collection)
+					tile.data().setLanguage(title->language);
+			}
+			auto imageUrl = frame.imageUrl(type == TileData::Type::Collection ? "default" : kind);
+			tile.data().setImageURL(imageUrl);
+			//entries without an id fall back to what is on screen, so they only match an identical tile
+			tile.data().setContentId(frame.contentId.empty() ? std::string(tile.data().title()) + imageUrl : frame.contentId);
+			tile.data().setType(type);
+			if (type != TileData::Type::Collection)
+				tile.data().setRating(frame.rating);
+			frame.tiles.push_back(std::move(tile));
+		}
+
+		const RowSink& _sink;
+		std::vector<Frame> _frames;
+		std::vector<PathElement> _path;
+	};
+}
+
+namespace
+{
+	template<typename Input>
+	bool parseRefSetFrom(Input&& json, std::vector<Tile>& tiles)
+	{
+		bool found = false;
+		bool ok = parseCatalog(json, [&](Row&& row) {
+			if (found || row.isRefSet)
+				return;
+			found = true;
+			tiles = std::move(row._tiles);
+			});
+		return ok && found;
+	}
+}
+
+bool parseCatalog(std::string_view json, const RowSink& sink)
+{
+	CatalogHandler handler(sink);
+	return nlohmann::json::sax_parse(json.begin(), json.end(), &handler);
+}
+
+bool parseCatalog(std::istream& json, const RowSink& sink)
+{
+	CatalogHandler handler(sink);
+	return nlohmann::json::sax_parse(json, &handler);
+}
+
+bool parseRefSet(std::string_view json, std::vector<Tile>& tiles)
+{
+	return parseRefSetFrom(json, tiles);
+}
+
+bool parseRefSet(std::istream& json, std::vector<Tile>& tiles)
+{
+	return parseRefSetFrom(json, tiles);
+}
+
+void benchmarkCatalogParse(const std::vector<std::string>& files, std::ostream& os)
+{
+	using clock = std::chrono::steady_clock;
+	constexpr int passes = 5;
+	auto milliseconds = [](clock::time_point begin) { return std::chrono::duration<double, std::milli>(clock::now() - begin).count(); };
+
+	for (auto&& file : files)
+	{
+		if (!std::ifstream(file))
+		{
+			os << "Catalog parse benchmark: could not open " << file << std::endl;
+			continue;
+		}
+
+		//peak growth over what was resident before each path, the high-water mark is reset in between where possible
+		bool resettable = resetPeakResidentBytes();
+		size_t before = residentBytes();
+		size_t rows = 0;
+		size_t tiles = 0;
+		LatencyStats streamed;
+		for (int pass = 0; pass < passes; ++pass)
+		{
+			rows = tiles = 0;
+			auto begin = clock::now();
+			std::ifstream json(file, std::ios::binary);
+			parseCatalog(json, [&](Row&& row) {
+				rows++;
+				tiles += row._tiles.size();
+				});
+			streamed.record(milliseconds(begin));
+		}
+		size_t streamedPeak = peakResidentBytes() - std::min(peakResidentBytes(), before);
+
+		resetPeakResidentBytes();
+		before = residentBytes();
+		LatencyStats retained;
+		size_t textBytes = 0;
+		for (int pass = 0; pass < passes; ++pass)
+		{
+			auto begin = clock::now();
+			std::ifstream in(file, std::ios::binary);
+			std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+			auto document = nlohmann::json::parse(text, nullptr, false);
+			retained.record(milliseconds(begin));
+			textBytes = text.size();
+		}
+		size_t retainedPeak = peakResidentBytes() - std::min(peakResidentBytes(), before);
+
+		os << "Catalog parse benchmark: " << file << ", " << textBytes << " bytes, " << rows << " rows, " << tiles << " tiles" << std::endl;
+		os << "  streaming SAX: p50 " << streamed.percentile(50.0) << " ms, peak RSS +" << streamedPeak / 1024 << " kB" << std::endl;
+		os << "  retained text and DOM: p50 " << retained.percentile(50.0) << " ms, peak RSS +" << retainedPeak / 1024 << " kB"
+			<< (resettable ? "" : " (high-water mark not resettable, read after the streaming run)") << std::endl;
+	}
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <functional>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct Row;
+class Tile;
+
+//Schema directed SAX parser for the home page and ref set documents.  Rows are built as their
+//set objects close, so no DOM is kept and only the fields the grid uses are copied out.
+using RowSink = std::function<void(Row&& row)>;
+
+bool parseCatalog(std::string_view json, const RowSink& sink);
+bool parseCatalog(std::istream& json, const RowSink& sink);
+
+//Tiles of the set a ref set document describes
+bool parseRefSet(std::string_view json, std::vector<Tile>& tiles);
+bool parseRefSet(std::istream& json, std::vector<Tile>& tiles);
+
+//Parses each recorded home or set document, first with this parser streaming from the file and then
+//into a retained nlohmann DOM as the grid used to be built, reporting parse time and peak RSS growth
+void benchmarkCatalogParse(const std::vector<std::string>& files, std::ostream& os);
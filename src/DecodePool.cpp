@@ -0,0 +1,180 @@
+#include "DecodePool.h"
+#include "DiskCache.h"
+#include "ImageCache.h"
+#include <algorithm>
+
+DecodePool& DecodePool::instance()
+{
+	static DecodePool pool;
+	return pool;
+}
+
+DecodePool::DecodePool()
+{
+	//decodes finish into the image cache and write compressed images to the disk cache
+	DiskCache::instance();
+	ImageCache::instance();
+
+	_jobs.reserve(default_capacity);
+	for (size_t i = 0; i < worker_count; ++i)
+		_workers.emplace_back([this]() { workerLoop(); });
+}
+
+DecodePool::~DecodePool()
+{
+	stop();
+}
+
+void DecodePool::stop()
+{
+	{
+		std::lock_guard lock(_mutex);
+		if (_stopping)
+			return;
+		_stopping = true;
+	}
+	_wake.notify_all();
+	_space.notify_all();
+	for (auto&& worker : _workers)
+		worker.join();
+}
+
+bool DecodePool::submit(std::shared_ptr<FetchTicket> ticket, std::function<void()> work, std::function<void()> dropped)
+{
+	{
+		std::unique_lock lock(_mutex);
+		if (_jobs.size() >= _capacity && !_stopping)
+		{
+			//slots held by jobs nobody wants any more are freed before anything waits on them
+			lock.unlock();
+			dropCancelled();
+			lock.lock();
+		}
+		if (_jobs.size() >= _capacity && !_stopping)
+		{
+			_stalls++;
+			auto stallBegin = std::chrono::steady_clock::now();
+			//cancelling does not notify, so check back now and then
+			while (_jobs.size() >= _capacity && !_stopping && !ticket->cancelled())
+			{
+				_space.wait_for(lock, std::chrono::milliseconds(10));
+				lock.unlock();
+				dropCancelled();
+				lock.lock();
+			}
+			_stallTime.record(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - stallBegin).count());
+		}
+		if (_stopping || ticket->cancelled())
+		{
+			_abandoned++;
+			return false;
+		}
+		_jobs.push_back({ std::move(ticket), std::move(work), std::move(dropped), _next++, std::chrono::steady_clock::now() });
+		_peakQueued = std::max(_peakQueued, _jobs.size());
+	}
+	_wake.notify_one();
+	return true;
+}
+
+size_t DecodePool::dropCancelled()
+{
+	std::vector<std::function<void()>> callbacks;
+	size_t count = 0;
+	{
+		std::lock_guard lock(_mutex);
+		count = std::erase_if(_jobs, [&callbacks](Job& job) {
+			if (!job.ticket->cancelled())
+				return false;
+			if (job.dropped)
+				callbacks.push_back(std::move(job.dropped));
+			return true;
+			});
+		_dropped += count;
+	}
+	if (count)
+		_space.notify_all();
+
+	//outside the lock, they may well submit again
+	for (auto&& callback : callbacks)
+		callback();
+	return count;
+}
+
+DecodePool::Job DecodePool::take()
+{
+	//tickets reorder while queued, so the order is read as the job is taken
+	auto best = std::min_element(_jobs.begin(), _jobs.end(), [](const Job& a, const Job& b) {
+		int64_t orderA = a.ticket->_order;
+		int64_t orderB = b.ticket->_order;
+		return orderA != orderB ? orderA < orderB : a.sequence < b.sequence;
+		});
+	Job job = std::move(*best);
+	*best = std::move(_jobs.back());
+	_jobs.pop_back();
+	return job;
+}
+
+void DecodePool::workerLoop()
+{
+	while (true)
+	{
+		Job job;
+		bool cancelled = false;
+		{
+			std::unique_lock lock(_mutex);
+			_wake.wait(lock, [this]() { return _stopping || !_jobs.empty(); });
+			if (_stopping)
+				return;
+			job = take();
+			cancelled = job.ticket->cancelled();
+			if (cancelled)
+				_dropped++;
+		}
+		_space.notify_one();
+
+		if (cancelled)
+		{
+			if (job.dropped)
+				job.dropped();
+			continue;
+		}
+
+		auto begin = std::chrono::steady_clock::now();
+		_queueWait.record(std::chrono::duration<double, std::milli>(begin - job.queued).count());
+		{
+			FetchTicket::Scope scope(job.ticket.get());
+			job.work();
+		}
+		_runTime.record(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count());
+
+		std::lock_guard lock(_mutex);
+		_completed++;
+	}
+}
+
+void DecodePool::setCapacity(size_t jobs)
+{
+	{
+		std::lock_guard lock(_mutex);
+		_capacity = std::max<size_t>(jobs, 1);
+	}
+	_space.notify_all();
+}
+
+size_t DecodePool::queued() const
+{
+	std::lock_guard lock(_mutex);
+	return _jobs.size();
+}
+
+void DecodePool::report(std::ostream& os) const
+{
+	{
+		std::lock_guard lock(_mutex);
+		os << "Decode pool: " << _workers.size() << " workers, " << _completed << " jobs completed, queue " << _jobs.size() << "/" << _capacity
+			<< ", peak queue " << _peakQueued << ", " << _stalls << " submits blocked on a full queue, " << _abandoned << " abandoned, " << _dropped << " dropped after cancelling" << std::endl;
+	}
+	_queueWait.report(os, "Decode queue wait");
+	_runTime.report(os, "Decode job time");
+	_stallTime.report(os, "Decode backpressure stall");
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+#include "FetchScheduler.h"
+#include "Stats.h"
+
+//Fixed set of threads for the CPU bound half of image loading (decode, mips, compression), fed
+//by the network workers so a slow download never holds a thread that could be decoding.  Every
+//worker takes the best queued job in FetchScheduler's (priority, distance, submission) order from
+//one shared queue.  It holds at most capacity jobs, so picking the best is a short scan that always
+//sees current priorities; past capacity submit blocks the network worker handing over, so downloads
+//cannot run ahead of decoding.  Jobs cancelled while queued give up their slot straight away.
+class DecodePool
+{
+public:
+	static constexpr inline size_t worker_count = 4;
+	static constexpr inline size_t default_capacity = 16;
+
+	static DecodePool& instance();
+
+	//Blocks while the queue is full.  Returns false without queueing if the ticket is cancelled
+	//while waiting, or the pool is stopping.  Queued work runs with the ticket current, unless it is
+	//cancelled before it starts: then it is dropped and dropped (if set) runs instead.
+	bool submit(std::shared_ptr<FetchTicket> ticket, std::function<void()> work, std::function<void()> dropped = {});
+
+	void setCapacity(size_t jobs);
+	size_t queued() const;
+
+	//Joins the workers, dropping whatever is still queued
+	void stop();
+
+	void report(std::ostream& os) const;
+
+	~DecodePool();
+	DecodePool(const DecodePool&) = delete;
+	DecodePool& operator=(const DecodePool&) = delete;
+
+private:
+	DecodePool();
+
+	struct Job
+	{
+		std::shared_ptr<FetchTicket> ticket;
+		std::function<void()> work;
+		std::function<void()> dropped;
+		uint64_t sequence = 0;
+		std::chrono::steady_clock::time_point queued;
+	};
+
+	//The best job in the queue, which must not be empty
+	Job take();
+	//Removes cancelled jobs from the queue and runs their dropped callbacks
+	size_t dropCancelled();
+	void workerLoop();
+
+	std::vector<std::thread> _workers;
+
+	//guards the queue and the counts below
+	mutable std::mutex _mutex;
+	std::condition_variable _wake;
+	std::condition_variable _space;
+	std::vector<Job> _jobs;
+	size_t _capacity = default_capacity;
+	size_t _peakQueued = 0;
+	uint64_t _next = 0;
+	uint64_t _completed = 0;
+	uint64_t _stalls = 0;
+	uint64_t _abandoned = 0;
+	uint64_t _dropped = 0;
+	bool _stopping = false;
+
+	LatencyStats _queueWait;
+	LatencyStats _runTime;
+	LatencyStats _stallTime;
+};
@@ -0,0 +1,231 @@
+#include "DiskCache.h"
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+
+namespace
+{
+	constexpr std::string_view EntryExtension = ".entry";
+	constexpr std::string_view TempExtension = ".tmp";
+	//the old layout, a body file and a meta file per entry
+	constexpr std::string_view BodyExtension = ".body";
+	constexpr std::string_view MetaExtension = ".meta";
+
+	//another process may share the directory, so names also carry a per-process random part
+	const uint32_t TempPrefix = std::random_device{}();
+	std::atomic<uint64_t> TempFiles{ 0 };
+
+	//Writes a uniquely named file next to the destination, renamed over it by commitFile so readers
+	//never see a partial file.  Empty on failure.
+	std::filesystem::path writeTemp(const std::filesystem::path& path, std::string_view header, std::string_view contents)
+	{
+		auto tempPath = path;
+		tempPath += "." + std::to_string(TempPrefix) + "-" + std::to_string(TempFiles++) + std::string(TempExtension);
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		if (file)
+			file.write(header.data(), (std::streamsize)header.size());
+		if (file)
+			file.write(contents.data(), (std::streamsize)contents.size());
+		if (!file)
+		{
+			file.close();
+			std::error_code ec;
+			std::filesystem::remove(tempPath, ec);
+			return {};
+		}
+		return tempPath;
+	}
+
+	bool commitFile(const std::filesystem::path& tempPath, const std::filesystem::path& path)
+	{
+		std::error_code ec;
+		std::filesystem::rename(tempPath, path, ec);
+		return !ec;
+	}
+}
+
+DiskCache& DiskCache::instance()
+{
+	static DiskCache cache;
+	return cache;
+}
+
+DiskCache::DiskCache()
+{
+	std::error_code ec;
+	_directory = std::filesystem::temp_directory_path(ec) / "disney_streaming_cache";
+	std::filesystem::create_directories(_directory, ec);
+	if (ec)
+	{
+		std::cerr << "Disk cache unavailable: " << ec.message() << std::endl;
+		return;
+	}
+
+	for (auto&& file : std::filesystem::directory_iterator(_directory, ec))
+	{
+		//left behind by a process that stopped between writing and renaming, or by the old layout
+		auto extension = file.path().extension();
+		if (extension == TempExtension || extension == BodyExtension || extension == MetaExtension)
+		{
+			std::error_code removeError;
+			std::filesystem::remove(file.path(), removeError);
+			continue;
+		}
+		if (extension != EntryExtension)
+			continue;
+		auto key = file.path().stem().string();
+		IndexEntry entry;
+		entry.size = file.file_size(ec);
+		entry.lastUse = file.last_write_time(ec);
+		_totalBytes += entry.size;
+		_index[key] = entry;
+	}
+	evict();
+}
+
+std::string DiskCache::keyFor(const std::string& url)
+{
+	//FNV-1a
+	uint64_t hash = 14695981039346656037ull;
+	for (unsigned char c : url)
+	{
+		hash ^= c;
+		hash *= 1099511628211ull;
+	}
+	static constexpr const char* Digits = "0123456789abcdef";
+	std::string key(16, '0');
+	for (int i = 15; i >= 0; --i, hash >>= 4)
+		key[i] = Digits[hash & 0xf];
+	return key;
+}
+
+std::filesystem::path DiskCache::entryPath(const std::string& key) const
+{
+	return _directory / (key + std::string(EntryExtension));
+}
+
+bool DiskCache::load(const std::string& url, std::string& body, Entry& entry)
+{
+	auto key = keyFor(url);
+	{
+		std::lock_guard lock(_mutex);
+		if (!_index.count(key))
+		{
+			_misses++;
+			return false;
+		}
+	}
+
+	//the header is three lines: url, etag, last-modified.  An entry replaced meanwhile is a whole new
+	//file, the open one still reads as the old entry.
+	std::ifstream file(entryPath(key), std::ios::binary);
+	std::string storedUrl;
+	if (!std::getline(file, storedUrl) || storedUrl != url || !std::getline(file, entry.etag) || !std::getline(file, entry.lastModified))
+	{
+		std::lock_guard lock(_mutex);
+		_misses++;
+		return false;
+	}
+	std::ostringstream stream;
+	stream << file.rdbuf();
+	body = std::move(stream).str();
+
+	auto now = std::filesystem::file_time_type::clock::now();
+	{
+		std::lock_guard lock(_mutex);
+		_hits++;
+		markUsed(key, now);
+	}
+	touchFile(key, now);
+	return true;
+}
+
+void DiskCache::store(const std::string& url, std::string_view body, const Entry& entry)
+{
+	auto key = keyFor(url);
+
+	//the write happens outside the lock, only the rename and the index update are under it
+	auto header = url + "\n" + entry.etag + "\n" + entry.lastModified + "\n";
+	auto temp = writeTemp(entryPath(key), header, body);
+	if (temp.empty())
+		return;
+
+	std::lock_guard lock(_mutex);
+	if (!commitFile(temp, entryPath(key)))
+	{
+		std::error_code ec;
+		std::filesystem::remove(temp, ec);
+		return;
+	}
+
+	auto& indexEntry = _index[key];
+	_totalBytes -= indexEntry.size;
+	indexEntry.size = header.size() + body.size();
+	indexEntry.lastUse = std::filesystem::file_time_type::clock::now();
+	_totalBytes += indexEntry.size;
+	evict();
+}
+
+void DiskCache::touch(const std::string& url)
+{
+	auto key = keyFor(url);
+	auto now = std::filesystem::file_time_type::clock::now();
+	{
+		std::lock_guard lock(_mutex);
+		if (!_index.count(key))
+			return;
+		markUsed(key, now);
+	}
+	touchFile(key, now);
+}
+
+bool DiskCache::claimRevalidation(const std::string& url)
+{
+	std::lock_guard lock(_mutex);
+	return _revalidated.insert(url).second;
+}
+
+void DiskCache::setCapacity(uint64_t bytes)
+{
+	std::lock_guard lock(_mutex);
+	_capacity = bytes;
+	evict();
+}
+
+void DiskCache::markUsed(const std::string& key, std::filesystem::file_time_type now)
+{
+	_index[key].lastUse = now;
+}
+
+void DiskCache::touchFile(const std::string& key, std::filesystem::file_time_type now) const
+{
+	//the entry may have been evicted or replaced since, then there is nothing to touch or the new
+	//file gets a time it nearly has anyway
+	std::error_code ec;
+	std::filesystem::last_write_time(entryPath(key), now, ec);
+}
+
+void DiskCache::evict()
+{
+	while (_totalBytes > _capacity && !_index.empty())
+	{
+		auto oldest = std::min_element(_index.begin(), _index.end(), [](const auto& lhs, const auto& rhs) {
+			return lhs.second.lastUse < rhs.second.lastUse;
+			});
+		std::error_code ec;
+		std::filesystem::remove(entryPath(oldest->first), ec);
+		_totalBytes -= oldest->second.size;
+		_index.erase(oldest);
+		_evictions++;
+	}
+}
+
+void DiskCache::report(std::ostream& os) const
+{
+	std::lock_guard lock(_mutex);
+	os << "Disk cache: " << _index.size() << " entries, " << _totalBytes << "/" << _capacity << " bytes, "
+		<< _hits << " hits, " << _misses << " misses, " << _evictions << " evictions" << std::endl;
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+
+//Persistent HTTP cache keyed by a hash of the URL.  Each entry is one file: a header of the URL and
+//the validators needed for conditional requests, then the body.  Entries are replaced by renaming
+//a complete file over them, so a reader always gets validators and body from the same response.
+class DiskCache
+{
+public:
+	static constexpr inline uint64_t default_capacity = 256ull * 1024ull * 1024ull;
+
+	struct Entry
+	{
+		std::string etag;
+		std::string lastModified;
+	};
+
+	static DiskCache& instance();
+
+	bool load(const std::string& url, std::string& body, Entry& entry);
+	void store(const std::string& url, std::string_view body, const Entry& entry);
+
+	//Marks a cached entry as fresh after a 304
+	void touch(const std::string& url);
+
+	//Returns true the first time it is called for a url in this process
+	bool claimRevalidation(const std::string& url);
+
+	void setCapacity(uint64_t bytes);
+	void report(std::ostream& os) const;
+
+private:
+	DiskCache();
+
+	struct IndexEntry
+	{
+		uint64_t size = 0;
+		std::filesystem::file_time_type lastUse;
+	};
+
+	static std::string keyFor(const std::string& url);
+	std::filesystem::path entryPath(const std::string& key) const;
+
+	//Records the use in the index, the caller holds the lock.  The entry file's time, which carries
+	//it over to the next run, is set by touchFile outside the lock.
+	void markUsed(const std::string& key, std::filesystem::file_time_type now);
+	void touchFile(const std::string& key, std::filesystem::file_time_type now) const;
+	void evict();
+
+	std::filesystem::path _directory;
+
+	mutable std::mutex _mutex;
+	std::unordered_map<std::string, IndexEntry> _index;
+	std::unordered_set<std::string> _revalidated;
+	uint64_t _totalBytes = 0;
+	uint64_t _capacity = default_capacity;
+
+	uint64_t _hits = 0;
+	uint64_t _misses = 0;
+	uint64_t _evictions = 0;
+};
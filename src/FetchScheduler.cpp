@@ -0,0 +1,322 @@
+#include "FetchScheduler.h"
+#include "RemoteAccess.h"
+#include "DiskCache.h"
+#include "DecodePool.h"
+#include <algorithm>
+#include <cstdlib>
+
+namespace
+{
+	thread_local const FetchTicket* s_currentTicket = nullptr;
+
+	//Stand-in for one tile load: waiting on the network, then a fixed amount of decode work
+	void syntheticLoad(std::atomic<int>& running, std::atomic<int>& peak)
+	{
+		int now = ++running;
+		int seen = peak;
+		while (now > seen && !peak.compare_exchange_weak(seen, now)) {}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		volatile uint32_t hash = 2166136261u;
+		for (uint32_t i = 0; i < 2000000; ++i)
+			hash = (hash ^ i) * 16777619u;
+		--running;
+	}
+}
+
+FetchTicket::FetchTicket(FetchPriority priority, int distance) : _order(makeOrder(priority, distance))
+{
+}
+
+void FetchTicket::setPriority(FetchPriority priority, int distance)
+{
+	auto order = makeOrder(priority, distance);
+	//called every frame for most tickets, the queue only hears of actual changes
+	if (_order.exchange(order) != order && _scheduled > 0)
+		FetchScheduler::instance().reprioritize(*this, order);
+}
+
+void FetchTicket::cancel()
+{
+	if (!_cancelled.exchange(true) && _scheduled > 0)
+		FetchScheduler::instance().reprioritize(*this, FetchScheduler::cancelled_order);
+}
+
+FetchPriority FetchTicket::priority() const
+{
+	return (FetchPriority)(_order >> 32);
+}
+
+const FetchTicket* FetchTicket::current()
+{
+	return s_currentTicket;
+}
+
+bool FetchTicket::currentCancelled()
+{
+	return s_currentTicket && s_currentTicket->cancelled();
+}
+
+FetchTicket::Scope::Scope(const FetchTicket* ticket) : _previous(s_currentTicket)
+{
+	s_currentTicket = ticket;
+}
+
+FetchTicket::Scope::~Scope()
+{
+	s_currentTicket = _previous;
+}
+
+int64_t FetchTicket::makeOrder(FetchPriority priority, int distance)
+{
+	return ((int64_t)priority << 32) | (uint32_t)std::max(distance, 0);
+}
+
+FetchScheduler& FetchScheduler::instance()
+{
+	static FetchScheduler scheduler;
+	return scheduler;
+}
+
+FetchScheduler::FetchScheduler()
+{
+	//workers use the client, the disk cache and the decode pool until they are joined, so they have to be constructed (and destroyed) around us
+	HttpClient::instance();
+	DiskCache::instance();
+	DecodePool::instance();
+
+	for (size_t i = 0; i < worker_count; ++i)
+		_workers.emplace_back([this]() { workerLoop(); });
+}
+
+FetchScheduler::~FetchScheduler()
+{
+	//workers can be blocked handing work to the decode pool, and decodes can post follow up work here
+	DecodePool::instance().stop();
+	{
+		std::lock_guard lock(_mutex);
+		_stopping = true;
+		//tickets outliving us must not call back in
+		for (auto&& [sequence, job] : _jobs)
+			job.ticket->_scheduled--;
+		_jobs.clear();
+		_ticketJobs.clear();
+		_heap.clear();
+	}
+	_wake.notify_all();
+	for (auto&& worker : _workers)
+		worker.join();
+}
+
+void FetchScheduler::post(std::shared_ptr<FetchTicket> ticket, std::function<void()> work, std::function<void()> dropped)
+{
+	enqueue(std::move(ticket), std::move(work), std::move(dropped));
+}
+
+bool FetchScheduler::later(const Entry& lhs, const Entry& rhs)
+{
+	return lhs.order != rhs.order ? lhs.order > rhs.order : lhs.sequence > rhs.sequence;
+}
+
+void FetchScheduler::enqueue(std::shared_ptr<FetchTicket> ticket, std::function<void()> work, std::function<void()> dropped)
+{
+	{
+		std::lock_guard lock(_mutex);
+		if (_stopping)
+			return;
+		auto sequence = _sequence++;
+		ticket->_scheduled++;
+		_ticketJobs.emplace(ticket.get(), sequence);
+		int64_t order = ticket->cancelled() ? cancelled_order : (int64_t)ticket->_order;
+		_jobs.emplace(sequence, Job{ std::move(ticket), std::move(work), std::move(dropped), sequence, std::chrono::steady_clock::now() });
+		pushLocked(order, sequence);
+		_peakQueued = std::max(_peakQueued, _jobs.size());
+	}
+	_wake.notify_one();
+}
+
+void FetchScheduler::reprioritize(const FetchTicket& ticket, int64_t order)
+{
+	{
+		std::lock_guard lock(_mutex);
+		auto [begin, end] = _ticketJobs.equal_range(&ticket);
+		if (begin == end)
+			return;
+		for (auto itr = begin; itr != end; ++itr)
+			pushLocked(order, itr->second);
+	}
+	_wake.notify_one();
+}
+
+void FetchScheduler::pushLocked(int64_t order, uint64_t sequence)
+{
+	_heap.push_back({ order, sequence });
+	std::push_heap(_heap.begin(), _heap.end(), later);
+
+	//tickets that keep changing leave stale entries behind, past twice the live ones the heap is
+	//rebuilt from the jobs
+	if (_heap.size() <= _jobs.size() * 2 + 64)
+		return;
+	_heap.clear();
+	for (auto&& [queued, job] : _jobs)
+		_heap.push_back({ job.ticket->cancelled() ? cancelled_order : (int64_t)job.ticket->_order, queued });
+	std::make_heap(_heap.begin(), _heap.end(), later);
+	_rebuilds++;
+}
+
+bool FetchScheduler::popLocked(Job& job)
+{
+	while (!_heap.empty())
+	{
+		std::pop_heap(_heap.begin(), _heap.end(), later);
+		auto entry = _heap.back();
+		_heap.pop_back();
+
+		//taken through a newer entry already, or pushed again at the order it has now
+		auto itr = _jobs.find(entry.sequence);
+		if (itr == _jobs.end() || (!itr->second.ticket->cancelled() && itr->second.ticket->_order != entry.order))
+		{
+			_staleEntries++;
+			continue;
+		}
+
+		job = std::move(itr->second);
+		_jobs.erase(itr);
+		auto [begin, end] = _ticketJobs.equal_range(job.ticket.get());
+		_ticketJobs.erase(std::find_if(begin, end, [&job](const auto& ticketJob) { return ticketJob.second == job.sequence; }));
+		job.ticket->_scheduled--;
+		return true;
+	}
+	return false;
+}
+
+void FetchScheduler::workerLoop()
+{
+	while (true)
+	{
+		Job job;
+		{
+			std::unique_lock lock(_mutex);
+			_wake.wait(lock, [this]() { return _stopping || !_heap.empty(); });
+			if (_stopping)
+				return;
+			if (!popLocked(job))
+				continue;
+			if (job.ticket->cancelled())
+				_cancelled++;
+		}
+
+		if (job.ticket->cancelled())
+		{
+			//outside the lock, it may well post again
+			if (job.dropped)
+				job.dropped();
+			continue;
+		}
+
+		auto begin = std::chrono::steady_clock::now();
+		_queueWait.record(std::chrono::duration<double, std::milli>(begin - job.queued).count());
+		{
+			FetchTicket::Scope scope(job.ticket.get());
+			job.work();
+		}
+		_runTime.record(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count());
+
+		std::lock_guard lock(_mutex);
+		_completed++;
+	}
+}
+
+size_t FetchScheduler::queued() const
+{
+	std::lock_guard lock(_mutex);
+	return _jobs.size();
+}
+
+void FetchScheduler::report(std::ostream& os) const
+{
+	{
+		std::lock_guard lock(_mutex);
+		os << "Fetch scheduler: " << _workers.size() << " workers, " << _completed << " jobs completed, " << _cancelled << " cancelled before starting, queue "
+			<< _jobs.size() << ", peak queue " << _peakQueued << ", " << _staleEntries << " stale heap entries skipped, " << _rebuilds << " heap rebuilds" << std::endl;
+	}
+	_queueWait.report(os, "Fetch queue wait");
+	_runTime.report(os, "Fetch job time");
+}
+
+void FetchScheduler::benchmark(size_t rows, std::ostream& os)
+{
+	using clock = std::chrono::steady_clock;
+	constexpr size_t columns = 20;
+	constexpr size_t visibleRows = 4;
+	constexpr size_t visibleColumns = 5;
+	size_t firstVisible = rows / 2;
+
+	auto priorityOf = [&](size_t row, size_t column, int& distance) {
+		distance = std::abs((int)row - (int)firstVisible) + (int)column;
+		if (row >= firstVisible && row < firstVisible + visibleRows && column < visibleColumns)
+			return FetchPriority::Visible;
+		if (row + 1 >= firstVisible && row <= firstVisible + visibleRows)
+			return FetchPriority::Neighbour;
+		return FetchPriority::Prefetch;
+	};
+
+	//milliseconds from the start until every visible tile and every tile had loaded
+	auto load = [&](auto&& start, const char* name) {
+		std::atomic<int> running{ 0 };
+		std::atomic<int> peak{ 0 };
+		std::mutex mutex;
+		double visible = 0.0;
+		double all = 0.0;
+		auto begin = clock::now();
+		auto finished = [&](bool isVisible) {
+			double elapsed = std::chrono::duration<double, std::milli>(clock::now() - begin).count();
+			std::lock_guard lock(mutex);
+			if (isVisible)
+				visible = std::max(visible, elapsed);
+			all = std::max(all, elapsed);
+		};
+
+		//catalog order, as the rows arrive from the parser
+		for (size_t row = 0; row < rows; ++row)
+		{
+			for (size_t column = 0; column < columns; ++column)
+			{
+				int distance = 0;
+				auto priority = priorityOf(row, column, distance);
+				start(priority, distance, [&, isVisible = priority == FetchPriority::Visible]() {
+					syntheticLoad(running, peak);
+					finished(isVisible);
+				});
+			}
+		}
+		start.wait();
+
+		os << "  " << name << ": peak " << peak << " loads at once, visible tiles after " << visible << " ms, all after " << all << " ms" << std::endl;
+	};
+
+	os << "Fetch scheduler benchmark: " << rows << " rows of " << columns << " tiles, " << visibleRows << "x" << visibleColumns
+		<< " visible from row " << firstVisible << std::endl;
+
+	struct AsyncPerTile
+	{
+		std::vector<std::future<void>> loads;
+		void operator()(FetchPriority, int, std::function<void()> work) { loads.push_back(std::async(std::launch::async | std::launch::deferred, std::move(work))); }
+		void wait() { for (auto&& load : loads) load.wait(); }
+	};
+	AsyncPerTile asyncPerTile;
+	load(asyncPerTile, "std::async per tile");
+
+	struct Scheduled
+	{
+		std::vector<PendingFetch<void>> loads;
+		void operator()(FetchPriority priority, int distance, std::function<void()> work)
+		{
+			loads.push_back(instance().submit(priority, std::move(work)));
+			loads.back().setPriority(priority, distance);
+		}
+		void wait() { for (auto&& load : loads) load.get(); }
+	};
+	Scheduled scheduled;
+	load(scheduled, "fetch scheduler");
+}
@@ -0,0 +1,194 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include "Stats.h"
+
+enum class FetchPriority : int
+{
+	Visible = 0,
+	Neighbour,
+	Prefetch
+};
+
+//Shared between the requester and the queued job so the requester can re-prioritize work that has not started yet
+class FetchTicket
+{
+public:
+	explicit FetchTicket(FetchPriority priority, int distance = 0);
+
+	//Jobs run in (priority, distance, submission) order
+	void setPriority(FetchPriority priority, int distance = 0);
+	FetchPriority priority() const;
+
+	void cancel();
+	bool cancelled() const { return _cancelled; }
+
+	//Ticket of the job running on this thread, nullptr off the worker pools
+	static const FetchTicket* current();
+	static bool currentCancelled();
+
+	//Makes ticket current() on this thread for the lifetime of the scope
+	class Scope
+	{
+	public:
+		explicit Scope(const FetchTicket* ticket);
+		~Scope();
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+
+	private:
+		const FetchTicket* _previous;
+	};
+
+private:
+	friend class FetchScheduler;
+	friend class DecodePool;
+	static int64_t makeOrder(FetchPriority priority, int distance);
+
+	std::atomic<int64_t> _order;
+	std::atomic<bool> _cancelled{ false };
+	//jobs of this ticket waiting in FetchScheduler's queue, which is told when the order changes or
+	//the ticket is cancelled so they move in it
+	std::atomic<int> _scheduled{ 0 };
+};
+
+//Owning handle to a scheduled job.  Dropping it cancels the job: it is skipped if it has not
+//started, and network and decode stages abort at their next check if it has.
+template<typename T>
+class PendingFetch
+{
+public:
+	PendingFetch() = default;
+	PendingFetch(std::future<T> future, std::shared_ptr<FetchTicket> ticket) : _future(std::move(future)), _ticket(std::move(ticket)) {}
+	PendingFetch(PendingFetch&&) noexcept = default;
+	PendingFetch& operator=(PendingFetch&& other) noexcept
+	{
+		if (this != &other)
+		{
+			cancel();
+			_future = std::move(other._future);
+			_ticket = std::move(other._ticket);
+		}
+		return *this;
+	}
+	~PendingFetch() { cancel(); }
+
+	bool valid() const { return _future.valid(); }
+	bool ready() const { return _future.valid() && _future.wait_for(std::chrono::milliseconds(0)) == std::future_status::ready; }
+	T get() { _ticket = nullptr; return _future.get(); }
+	void setPriority(FetchPriority priority, int distance = 0) { if (_ticket) _ticket->setPriority(priority, distance); }
+
+	void cancel()
+	{
+		if (_ticket)
+			_ticket->cancel();
+		_ticket = nullptr;
+		_future = {};
+	}
+
+	//Lets the job run to completion with nobody waiting on the result
+	void detach()
+	{
+		_ticket = nullptr;
+		_future = {};
+	}
+
+private:
+	std::future<T> _future;
+	std::shared_ptr<FetchTicket> _ticket;
+};
+
+//Bounded worker pool shared by every network fetch in the app
+class FetchScheduler
+{
+public:
+	static constexpr inline size_t worker_count = 6;
+
+	static FetchScheduler& instance();
+
+	template<typename F>
+	auto submit(FetchPriority priority, F&& work) -> PendingFetch<std::invoke_result_t<F>>
+	{
+		using Result = std::invoke_result_t<F>;
+		auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(work));
+		auto ticket = std::make_shared<FetchTicket>(priority);
+		enqueue(ticket, [task]() { (*task)(); });
+		return PendingFetch<Result>(task->get_future(), std::move(ticket));
+	}
+
+	//Runs work under an existing ticket, for jobs that carry on in another pool.  If the ticket is
+	//cancelled before the job starts, dropped runs instead so the owner can clean up.
+	void post(std::shared_ptr<FetchTicket> ticket, std::function<void()> work, std::function<void()> dropped);
+
+	size_t queued() const;
+	void report(std::ostream& os) const;
+
+	//Loads a synthetic catalog of rows of tiles, scrolled to its middle, once with a std::async per
+	//tile as before the scheduler and once through it, reporting peak concurrency and time to visible tiles
+	static void benchmark(size_t rows, std::ostream& os);
+
+	~FetchScheduler();
+	FetchScheduler(const FetchScheduler&) = delete;
+	FetchScheduler& operator=(const FetchScheduler&) = delete;
+
+private:
+	friend class FetchTicket;
+
+	FetchScheduler();
+
+	struct Job
+	{
+		std::shared_ptr<FetchTicket> ticket;
+		std::function<void()> work;
+		std::function<void()> dropped;
+		uint64_t sequence = 0;
+		std::chrono::steady_clock::time_point queued;
+	};
+
+	//Place of a job in the heap at the order its ticket had when it was pushed.  Changing a ticket's
+	//order pushes its jobs again, so an entry whose order is no longer its ticket's is stale and
+	//skipped when it comes out.  Cancelling pushes them at cancelled_order, to be dropped straight away.
+	struct Entry
+	{
+		int64_t order;
+		uint64_t sequence;
+	};
+	static constexpr inline int64_t cancelled_order = std::numeric_limits<int64_t>::min();
+	static bool later(const Entry& lhs, const Entry& rhs);
+
+	void enqueue(std::shared_ptr<FetchTicket> ticket, std::function<void()> work, std::function<void()> dropped = {});
+	//Pushes the ticket's queued jobs at order, called by the ticket as its order changes or it is cancelled
+	void reprioritize(const FetchTicket& ticket, int64_t order);
+	void pushLocked(int64_t order, uint64_t sequence);
+	//The next job to run or drop, false once the heap holds only stale entries
+	bool popLocked(Job& job);
+	void workerLoop();
+
+	mutable std::mutex _mutex;
+	std::condition_variable _wake;
+	//min heap on (order, sequence)
+	std::vector<Entry> _heap;
+	std::unordered_map<uint64_t, Job> _jobs;
+	std::unordered_multimap<const FetchTicket*, uint64_t> _ticketJobs;
+	std::vector<std::thread> _workers;
+	uint64_t _sequence = 0;
+	uint64_t _completed = 0;
+	uint64_t _cancelled = 0;
+	uint64_t _staleEntries = 0;
+	uint64_t _rebuilds = 0;
+	size_t _peakQueued = 0;
+	bool _stopping = false;
+	LatencyStats _queueWait;
+	LatencyStats _runTime;
+};
@@ -0,0 +1,420 @@
+#include "GridSnapshot.h"
+#include "TileManager.h"
+#include "TileStrings.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <type_traits>
+#include <unordered_map>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	constexpr const char Magic[4] = { 'D', 'S', 'G', 'S' };
+
+	constexpr uint32_t RowIsRefSet = 1;
+	constexpr uint32_t RowRefSetResolved = 2;
+
+	//On disk layout: Header, StringRef vocabulary[vocabularyCount], RowRecord rows[rowCount],
+	//TileRecord tiles[tileCount], then the string blob every StringRef points into.
+	struct Header
+	{
+		char magic[4];
+		uint32_t version;
+		uint64_t fingerprint;
+		uint32_t vocabularyCount;
+		uint32_t rowCount;
+		uint32_t tileCount;
+		uint32_t blobSize;
+	};
+
+	struct StringRef
+	{
+		uint32_t offset;
+		uint32_t length;
+	};
+
+	struct RowRecord
+	{
+		StringRef title;
+		StringRef setId;
+		uint32_t firstTile;
+		uint32_t tileCount;
+		uint32_t flags;
+	};
+
+	//language, rating, imageHead and imageTail index the snapshot vocabulary, not the live TileStrings ids
+	struct TileRecord
+	{
+		uint32_t contentKeyLow;
+		uint32_t contentKeyHigh;
+		StringRef title;
+		StringRef imageId;
+		uint32_t imageHead;
+		uint32_t imageTail;
+		uint16_t language;
+		uint16_t rating;
+		uint32_t type;
+	};
+
+	static_assert(std::is_trivially_copyable_v<Header> && sizeof(Header) == 32);
+	//every section starts 4 byte aligned inside the page aligned mapping
+	static_assert(alignof(StringRef) == 4 && alignof(RowRecord) == 4 && alignof(TileRecord) == 4);
+
+	class MappedFile
+	{
+	public:
+		static std::shared_ptr<MappedFile> open(const std::filesystem::path& path)
+		{
+			auto file = std::shared_ptr<MappedFile>(new MappedFile());
+#ifdef _WIN32
+			file->_file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (file->_file == INVALID_HANDLE_VALUE)
+				return nullptr;
+			LARGE_INTEGER size;
+			if (!GetFileSizeEx(file->_file, &size) || size.QuadPart == 0)
+				return nullptr;
+			file->_mapping = CreateFileMappingW(file->_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (!file->_mapping)
+				return nullptr;
+			file->_data = static_cast<const char*>(MapViewOfFile(file->_mapping, FILE_MAP_READ, 0, 0, 0));
+			if (!file->_data)
+				return nullptr;
+			file->_size = (size_t)size.QuadPart;
+#else
+			int fd = ::open(path.c_str(), O_RDONLY);
+			if (fd < 0)
+				return nullptr;
+			struct stat info;
+			if (fstat(fd, &info) != 0 || info.st_size == 0)
+			{
+				::close(fd);
+				return nullptr;
+			}
+			void* data = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			::close(fd);
+			if (data == MAP_FAILED)
+				return nullptr;
+			file->_data = static_cast<const char*>(data);
+			file->_size = (size_t)info.st_size;
+#endif
+			return file;
+		}
+
+		~MappedFile()
+		{
+#ifdef _WIN32
+			if (_data)
+				UnmapViewOfFile(_data);
+			if (_mapping)
+				CloseHandle(_mapping);
+			if (_file != INVALID_HANDLE_VALUE)
+				CloseHandle(_file);
+#else
+			if (_data)
+				munmap(const_cast<char*>(_data), _size);
+#endif
+		}
+
+		const char* data() const { return _data; }
+		size_t size() const { return _size; }
+
+	private:
+		MappedFile() = default;
+
+		const char* _data = nullptr;
+		size_t _size = 0;
+#ifdef _WIN32
+		HANDLE _file = INVALID_HANDLE_VALUE;
+		HANDLE _mapping = nullptr;
+#endif
+	};
+
+	//FNV-1a, lengths are mixed in so adjacent fields cannot run into each other
+	class Fingerprint
+	{
+	public:
+		void add(std::string_view value)
+		{
+			add((uint64_t)value.size());
+			for (unsigned char c : value)
+				mix(c);
+		}
+
+		void add(uint64_t value)
+		{
+			for (int i = 0; i < 8; ++i, value >>= 8)
+				mix((unsigned char)(value & 0xff));
+		}
+
+		uint64_t value() const { return _hash; }
+
+	private:
+		void mix(unsigned char c)
+		{
+			_hash ^= c;
+			_hash *= 1099511628211ull;
+		}
+
+		uint64_t _hash = 14695981039346656037ull;
+	};
+
+	template<typename T>
+	const T* section(const char* data, uint64_t& offset, uint32_t count)
+	{
+		auto begin = reinterpret_cast<const T*>(data + offset);
+		offset += (uint64_t)count * sizeof(T);
+		return begin;
+	}
+}
+
+std::filesystem::path GridSnapshot::defaultPath()
+{
+	std::error_code ec;
+	return std::filesystem::temp_directory_path(ec) / "disney_streaming_home.snapshot";
+}
+
+uint64_t GridSnapshot::fingerprint(const Grid& grid)
+{
+	Fingerprint hash;
+	hash.add((uint64_t)grid._rows.size());
+	for (auto&& row : grid._rows)
+	{
+		hash.add(row.title);
+		hash.add(row.setId);
+		hash.add((uint64_t)row.isRefSet);
+		//ref set contents come from their own documents, whether or not they are resolved yet
+		if (row.isRefSet)
+			continue;
+		hash.add((uint64_t)row._tiles.size());
+		for (auto&& tile : row._tiles)
+		{
+			auto& data = tile.data();
+			hash.add(data.contentKey());
+			hash.add(data.title());
+			hash.add(data.imageURL());
+			hash.add(data.language());
+			hash.add(data.rating());
+			hash.add((uint64_t)data.type());
+		}
+	}
+	return hash.value();
+}
+
+bool GridSnapshot::save(const Grid& grid, uint64_t fingerprint, const std::filesystem::path& path)
+{
+	std::string blob;
+	auto addString = [&blob](std::string_view value) {
+		StringRef ref{ (uint32_t)blob.size(), (uint32_t)value.size() };
+		blob.append(value);
+		return ref;
+	};
+
+	std::vector<StringRef> vocabulary;
+	std::unordered_map<uint32_t, uint32_t> vocabularyIndex;
+	auto addInterned = [&](uint32_t id) {
+		auto [itr, inserted] = vocabularyIndex.emplace(id, (uint32_t)vocabulary.size());
+		if (inserted)
+			vocabulary.push_back(addString(TileStrings::instance().interned(id)));
+		return itr->second;
+	};
+	//tags go first so their indices fit the records' 16 bits, there are never more than max_tags of them
+	std::unordered_map<uint16_t, uint16_t> tagIndex;
+	auto addTag = [&](uint16_t id) {
+		auto [itr, inserted] = tagIndex.emplace(id, (uint16_t)vocabulary.size());
+		if (inserted)
+			vocabulary.push_back(addString(TileStrings::instance().tag(id)));
+		return itr->second;
+	};
+	for (auto&& row : grid._rows)
+	{
+		for (auto&& tile : row._tiles)
+		{
+			addTag(tile.data()._language);
+			addTag(tile.data()._rating);
+		}
+	}
+
+	std::vector<RowRecord> rows;
+	std::vector<TileRecord> tiles;
+	for (auto&& row : grid._rows)
+	{
+		RowRecord record{};
+		record.title = addString(row.title);
+		record.setId = addString(row.setId);
+		record.firstTile = (uint32_t)tiles.size();
+		record.tileCount = (uint32_t)row._tiles.size();
+		record.flags = (row.isRefSet ? RowIsRefSet : 0) | (row.refSetResolved ? RowRefSetResolved : 0);
+		rows.push_back(record);
+
+		for (auto&& tile : row._tiles)
+		{
+			auto& data = tile.data();
+			TileRecord tileRecord{};
+			tileRecord.contentKeyLow = (uint32_t)data._contentKey;
+			tileRecord.contentKeyHigh = (uint32_t)(data._contentKey >> 32);
+			tileRecord.title = addString(data.title());
+			tileRecord.imageId = addString({ data._imageId, data._imageIdLength });
+			tileRecord.imageHead = addInterned(data._imageHead);
+			tileRecord.imageTail = addInterned(data._imageTail);
+			tileRecord.language = addTag(data._language);
+			tileRecord.rating = addTag(data._rating);
+			tileRecord.type = (uint32_t)data._type;
+			tiles.push_back(tileRecord);
+		}
+	}
+
+	Header header{};
+	std::memcpy(header.magic, Magic, sizeof(Magic));
+	header.version = version;
+	header.fingerprint = fingerprint;
+	header.vocabularyCount = (uint32_t)vocabulary.size();
+	header.rowCount = (uint32_t)rows.size();
+	header.tileCount = (uint32_t)tiles.size();
+	header.blobSize = (uint32_t)blob.size();
+
+	//written beside the old snapshot and swapped in, so a crash never leaves a torn file behind
+	std::error_code ec;
+	auto tempPath = path;
+	tempPath += ".tmp";
+	{
+		std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		out.write(reinterpret_cast<const char*>(vocabulary.data()), vocabulary.size() * sizeof(StringRef));
+		out.write(reinterpret_cast<const char*>(rows.data()), rows.size() * sizeof(RowRecord));
+		out.write(reinterpret_cast<const char*>(tiles.data()), tiles.size() * sizeof(TileRecord));
+		out.write(blob.data(), blob.size());
+		if (!out)
+		{
+			std::cerr << "Failed to write grid snapshot " << tempPath << std::endl;
+			out.close();
+			std::filesystem::remove(tempPath, ec);
+			return false;
+		}
+	}
+
+	std::filesystem::rename(tempPath, path, ec);
+	if (ec)
+	{
+		std::cerr << "Failed to replace grid snapshot " << path << ": " << ec.message() << std::endl;
+		std::filesystem::remove(tempPath, ec);
+		return false;
+	}
+	return true;
+}
+
+bool GridSnapshot::load(const std::filesystem::path& path, Grid& grid, uint64_t& fingerprint)
+{
+	auto file = MappedFile::open(path);
+	if (!file)
+		return false;
+
+	const char* data = file->data();
+	if (file->size() < sizeof(Header))
+		return false;
+
+	Header header;
+	std::memcpy(&header, data, sizeof(header));
+	if (std::memcmp(header.magic, Magic, sizeof(Magic)) != 0 || header.version != version)
+	{
+		std::cerr << "Ignoring grid snapshot " << path << " written by another version" << std::endl;
+		return false;
+	}
+
+	uint64_t offset = sizeof(Header);
+	auto vocabulary = section<StringRef>(data, offset, header.vocabularyCount);
+	auto rows = section<RowRecord>(data, offset, header.rowCount);
+	auto tiles = section<TileRecord>(data, offset, header.tileCount);
+	auto blob = data + offset;
+	if (offset + header.blobSize != file->size())
+	{
+		std::cerr << "Ignoring truncated grid snapshot " << path << std::endl;
+		return false;
+	}
+
+	auto inBlob = [&header](const StringRef& ref) { return (uint64_t)ref.offset + ref.length <= header.blobSize; };
+	auto view = [blob](const StringRef& ref) { return std::string_view(blob + ref.offset, ref.length); };
+
+	for (uint32_t i = 0; i < header.vocabularyCount; ++i)
+	{
+		if (!inBlob(vocabulary[i]))
+			return false;
+	}
+	for (uint32_t i = 0; i < header.rowCount; ++i)
+	{
+		auto& row = rows[i];
+		if (!inBlob(row.title) || !inBlob(row.setId) || (uint64_t)row.firstTile + row.tileCount > header.tileCount)
+			return false;
+	}
+	for (uint32_t i = 0; i < header.tileCount; ++i)
+	{
+		auto& tile = tiles[i];
+		if (!inBlob(tile.title) || !inBlob(tile.imageId) || tile.type > (uint32_t)TileData::Type::Collection)
+			return false;
+		if (tile.imageHead >= header.vocabularyCount || tile.imageTail >= header.vocabularyCount ||
+			tile.language >= header.vocabularyCount || tile.rating >= header.vocabularyCount)
+			return false;
+	}
+
+	//only the small vocabulary is copied, titles and image ids are used in place
+	auto& strings = TileStrings::instance();
+	std::vector<uint32_t> ids(header.vocabularyCount);
+	for (uint32_t i = 0; i < header.vocabularyCount; ++i)
+		ids[i] = strings.intern(view(vocabulary[i]));
+	std::unordered_map<uint16_t, uint16_t> tags;
+	auto tagFor = [&](uint16_t index) {
+		auto [itr, inserted] = tags.emplace(index, 0);
+		if (inserted)
+			itr->second = strings.internTag(view(vocabulary[index]));
+		return itr->second;
+	};
+
+	Grid loaded;
+	loaded._rows.reserve(header.rowCount);
+	std::vector<std::string_view> inPlace;
+	for (uint32_t i = 0; i < header.rowCount; ++i)
+	{
+		auto& record = rows[i];
+		Row row;
+		row.title = view(record.title);
+		row.setId = view(record.setId);
+		row.isRefSet = (record.flags & RowIsRefSet) != 0;
+		row.refSetResolved = (record.flags & RowRefSetResolved) != 0;
+		row._tiles.resize(record.tileCount);
+		for (uint32_t t = 0; t < record.tileCount; ++t)
+		{
+			auto& tileRecord = tiles[record.firstTile + t];
+			auto& tile = row._tiles[t].data();
+			tile._contentKey = ((uint64_t)tileRecord.contentKeyHigh << 32) | tileRecord.contentKeyLow;
+			tile._title = blob + tileRecord.title.offset;
+			tile._titleLength = tileRecord.title.length;
+			tile._imageId = blob + tileRecord.imageId.offset;
+			tile._imageIdLength = tileRecord.imageId.length;
+			inPlace.push_back(tile.title());
+			inPlace.push_back({ tile._imageId, tile._imageIdLength });
+			tile._imageHead = ids[tileRecord.imageHead];
+			tile._imageTail = ids[tileRecord.imageTail];
+			tile._language = tagFor(tileRecord.language);
+			tile._rating = tagFor(tileRecord.rating);
+			tile._type = (TileData::Type)tileRecord.type;
+		}
+		loaded._rows.push_back(std::move(row));
+	}
+
+	strings.adopt(std::move(file), inPlace);
+	grid = std::move(loaded);
+	fingerprint = header.fingerprint;
+	return true;
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include <cstdint>
+#include <filesystem>
+
+struct Grid;
+
+//Flat, versioned binary image of a parsed Grid.  Loading maps the file and points tile titles and
+//image ids straight into the mapping, so the home page can be shown before any JSON is parsed.
+//The mapping is handed to TileStrings and stays alive for the rest of the process.
+class GridSnapshot
+{
+public:
+	static constexpr inline uint32_t version = 2;
+
+	static std::filesystem::path defaultPath();
+
+	//Hash of the rows as they come out of the home page parser, used to tell if a refresh changed anything
+	static uint64_t fingerprint(const Grid& grid);
+
+	static bool save(const Grid& grid, uint64_t fingerprint, const std::filesystem::path& path);
+	static bool load(const std::filesystem::path& path, Grid& grid, uint64_t& fingerprint);
+};
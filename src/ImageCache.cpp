@@ -0,0 +1,334 @@
+#include "ImageCache.h"
+#include "RemoteAccess.h"
+#include "FetchScheduler.h"
+#include "DecodePool.h"
+#include "ImageDecoder.h"
+#include "PixelKernels.h"
+#include "MipChain.h"
+#include "DiskCache.h"
+#include "Tile.h"
+
+#include <cstring>
+
+namespace
+{
+	//Disk cache body of a block compressed image, the blocks follow it
+	struct CompressedHeader
+	{
+		char magic[4];
+		uint32_t compression;
+		uint32_t width;
+		uint32_t height;
+		uint32_t textureWidth;
+		uint32_t textureHeight;
+		uint32_t levels;
+		uint32_t sourceWidth;
+		uint32_t sourceHeight;
+	};
+
+	constexpr char CompressedMagic[4] = { 'D', 'S', 'T', 'C' };
+
+	//The decoded size depends on the target and the mip setting as well as the source
+	std::string compressedKey(const std::string& url, uint32_t targetWidth, uint32_t targetHeight, bool mipmaps)
+	{
+		return url + "#bc1-" + std::to_string(targetWidth) + "x" + std::to_string(targetHeight) + (mipmaps ? "-mips" : "");
+	}
+
+	bool loadCompressed(const std::string& key, DecodedImage& image)
+	{
+		std::string body;
+		DiskCache::Entry entry;
+		if (!DiskCache::instance().load(key, body, entry) || body.size() < sizeof(CompressedHeader))
+			return false;
+
+		CompressedHeader header;
+		std::memcpy(&header, body.data(), sizeof(header));
+		if (std::memcmp(header.magic, CompressedMagic, sizeof(CompressedMagic)) != 0 || header.compression != (uint32_t)TextureCompression::BC1 ||
+			body.size() != sizeof(header) + bc1Size(header.textureWidth, header.textureHeight))
+			return false;
+
+		image.compression = TextureCompression::BC1;
+		image.width = header.width;
+		image.height = header.height;
+		image.textureWidth = header.textureWidth;
+		image.textureHeight = header.textureHeight;
+		image.levels = header.levels;
+		image.sourceWidth = header.sourceWidth;
+		image.sourceHeight = header.sourceHeight;
+		image.pixels.reset(new unsigned char[body.size() - sizeof(header)]);
+		std::memcpy(image.pixels.get(), body.data() + sizeof(header), body.size() - sizeof(header));
+		return true;
+	}
+
+	void storeCompressed(const std::string& key, const DecodedImage& image)
+	{
+		CompressedHeader header{ { CompressedMagic[0], CompressedMagic[1], CompressedMagic[2], CompressedMagic[3] }, (uint32_t)image.compression,
+			image.width, image.height, image.textureWidth, image.textureHeight, image.levels, image.sourceWidth, image.sourceHeight };
+		std::string body(reinterpret_cast<const char*>(&header), sizeof(header));
+		body.append(reinterpret_cast<const char*>(image.pixels.get()), image.bytes());
+		DiskCache::instance().store(key, body, {});
+	}
+
+	bool isOpaque(const DecodedImage& image)
+	{
+		const unsigned char* pixel = image.pixels.get();
+		for (size_t i = 0, count = (size_t)image.textureWidth * image.textureHeight; i < count; ++i, pixel += 4)
+		{
+			if (pixel[3] != 255)
+				return false;
+		}
+		return true;
+	}
+}
+
+ImageCache& ImageCache::instance()
+{
+	static ImageCache cache;
+	return cache;
+}
+
+ImageCache::Image ImageCache::find(const std::string& url)
+{
+	std::lock_guard lock(_mutex);
+	auto itr = _entries.find(url);
+	if (itr == _entries.end())
+		return nullptr;
+	_hits++;
+	_lru.splice(_lru.begin(), _lru, itr->second.lru);
+	return itr->second.image;
+}
+
+PendingFetch<ImageCache::Image> ImageCache::request(const std::string& url, FetchPriority priority)
+{
+	auto ticket = std::make_shared<FetchTicket>(priority);
+	std::promise<Image> promise;
+	auto future = promise.get_future();
+	{
+		std::lock_guard lock(_mutex);
+		if (auto itr = _entries.find(url); itr != _entries.end())
+		{
+			_hits++;
+			_lru.splice(_lru.begin(), _lru, itr->second.lru);
+			promise.set_value(itr->second.image);
+			return PendingFetch<Image>(std::move(future), std::move(ticket));
+		}
+
+		auto& waiting = _loading[url];
+		bool first = waiting.empty();
+		waiting.push_back({ ticket, std::move(promise) });
+		if (!first)
+		{
+			_hits++;
+			return PendingFetch<Image>(std::move(future), std::move(ticket));
+		}
+		_misses++;
+	}
+
+	start(url, ticket);
+	return PendingFetch<Image>(std::move(future), std::move(ticket));
+}
+
+void ImageCache::start(const std::string& url, std::shared_ptr<FetchTicket> ticket)
+{
+	FetchScheduler::instance().post(ticket, [this, url, ticket]() { fetch(url, ticket); }, [this, url]() { finish(url, nullptr); });
+}
+
+void ImageCache::fetch(const std::string& url, const std::shared_ptr<FetchTicket>& ticket)
+{
+	LoadSettings settings;
+	settings.targetWidth = _targetWidth;
+	settings.targetHeight = _targetHeight;
+	settings.mipmaps = _mipmaps;
+	settings.compression = _compression.load();
+	{
+		std::lock_guard lock(_mutex);
+		settings.fetchUrl = _urlRewrite.apply(url, settings.targetWidth);
+	}
+
+	if (settings.compression == TextureCompression::BC1)
+	{
+		auto image = std::make_shared<DecodedImage>();
+		if (loadCompressed(compressedKey(settings.fetchUrl, settings.targetWidth, settings.targetHeight, settings.mipmaps), *image))
+		{
+			{
+				std::lock_guard lock(_mutex);
+				_compressedDiskHits++;
+				_decodedBytes += image->bytes();
+				_sourceBytes += image->sourceBytes();
+			}
+			finish(url, image);
+			return;
+		}
+	}
+
+	auto jpegData = receiveImageData(settings.fetchUrl.c_str());
+	if (jpegData.empty() || FetchTicket::currentCancelled())
+	{
+		finish(url, nullptr);
+		return;
+	}
+	{
+		std::lock_guard lock(_mutex);
+		_downloads++;
+		_downloadedBytes += jpegData.size();
+	}
+
+	//std::function needs a copyable callable, so the bytes go over in a shared_ptr
+	auto data = std::make_shared<std::vector<unsigned char>>(std::move(jpegData));
+	if (!DecodePool::instance().submit(ticket, [this, url, settings, data]() { finish(url, decode(*data, settings)); }, [this, url]() { finish(url, nullptr); }))
+		finish(url, nullptr);
+}
+
+ImageCache::Image ImageCache::decode(const std::vector<unsigned char>& data, const LoadSettings& settings)
+{
+	if (FetchTicket::currentCancelled())
+		return nullptr;
+
+	auto decodeBegin = std::chrono::steady_clock::now();
+	auto image = std::make_shared<DecodedImage>();
+	if (!decodeImage(data.data(), data.size(), settings.targetWidth, settings.targetHeight, *image))
+		return nullptr;
+	_decodeTime.record(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - decodeBegin).count());
+
+	if (settings.mipmaps)
+	{
+		auto mipBegin = std::chrono::steady_clock::now();
+		buildMipChain(*image);
+		_mipTime.record(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - mipBegin).count());
+	}
+
+	//BC1 has no partial alpha, art that needs it stays RGBA
+	if (settings.compression == TextureCompression::BC1 && isOpaque(*image) && !FetchTicket::currentCancelled())
+	{
+		auto compressBegin = std::chrono::steady_clock::now();
+		std::unique_ptr<unsigned char[]> blocks(new unsigned char[bc1Size(image->textureWidth, image->textureHeight)]);
+		encodeBC1(image->pixels.get(), image->textureWidth, image->textureHeight, blocks.get());
+		image->pixels = std::move(blocks);
+		image->compression = TextureCompression::BC1;
+		_compressTime.record(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - compressBegin).count());
+		storeCompressed(compressedKey(settings.fetchUrl, settings.targetWidth, settings.targetHeight, settings.mipmaps), *image);
+	}
+
+	std::lock_guard lock(_mutex);
+	if (image->compression != TextureCompression::None)
+		_compressedImages++;
+	_decodedBytes += image->bytes();
+	_sourceBytes += image->sourceBytes();
+	return image;
+}
+
+void ImageCache::finish(const std::string& url, Image image)
+{
+	std::vector<Waiter> waiters;
+	std::shared_ptr<FetchTicket> next;
+	{
+		std::lock_guard lock(_mutex);
+		auto itr = _loading.find(url);
+		auto& waiting = itr->second;
+		if (!image && waiting.front().ticket->cancelled())
+		{
+			//cancelled requests have dropped their handles, the rest start over under the next ticket
+			_cancelled++;
+			std::erase_if(waiting, [](const Waiter& waiter) { return waiter.ticket->cancelled(); });
+			if (waiting.empty())
+				_loading.erase(itr);
+			else
+				next = waiting.front().ticket;
+		}
+		else
+		{
+			if (image)
+				insert(url, image);
+			waiters = std::move(waiting);
+			_loading.erase(itr);
+		}
+	}
+
+	if (next)
+		start(url, std::move(next));
+	for (auto&& waiter : waiters)
+		waiter.promise.set_value(image);
+}
+
+void ImageCache::insert(const std::string& url, Image image)
+{
+	_lru.push_front(url);
+	_residentBytes += image->bytes();
+	_entries[url] = { std::move(image), _lru.begin() };
+	evict();
+}
+
+void ImageCache::evict()
+{
+	auto itr = _lru.end();
+	while (_residentBytes > _budget && itr != _lru.begin())
+	{
+		--itr;
+		auto entry = _entries.find(*itr);
+		//still referenced by a tile
+		if (entry->second.image.use_count() > 1)
+			continue;
+
+		_residentBytes -= entry->second.image->bytes();
+		_entries.erase(entry);
+		itr = _lru.erase(itr);
+		_evictions++;
+	}
+}
+
+void ImageCache::setTargetSize(uint32_t width, uint32_t height)
+{
+	_targetWidth = width;
+	_targetHeight = height;
+}
+
+void ImageCache::targetSize(uint32_t& width, uint32_t& height) const
+{
+	width = _targetWidth;
+	height = _targetHeight;
+}
+
+void ImageCache::setMipmaps(bool enabled)
+{
+	_mipmaps = enabled;
+}
+
+void ImageCache::setCompression(TextureCompression compression)
+{
+	_compression = compression;
+}
+
+void ImageCache::setUrlRewrite(ImageUrlRewrite rewrite)
+{
+	std::lock_guard lock(_mutex);
+	_urlRewrite = std::move(rewrite);
+}
+
+void ImageCache::setBudget(size_t bytes)
+{
+	std::lock_guard lock(_mutex);
+	_budget = bytes;
+	evict();
+}
+
+size_t ImageCache::residentBytes() const
+{
+	std::lock_guard lock(_mutex);
+	return _residentBytes;
+}
+
+void ImageCache::report(std::ostream& os) const
+{
+	std::lock_guard lock(_mutex);
+	os << "Image cache: " << _entries.size() << " images, " << _residentBytes << "/" << _budget << " bytes, "
+		<< _hits << " hits, " << _misses << " misses, " << _evictions << " evictions, " << _cancelled << " cancelled decodes" << std::endl;
+	os << "Image decode: " << _decodedBytes << " bytes decoded for " << _sourceBytes << " bytes of full size artwork ("
+		<< (_sourceBytes ? (double)_decodedBytes / (double)_sourceBytes : 0.0) << "x)" << std::endl;
+	_decodeTime.report(os, std::string("Image decode time (") + pixelKernelLevelName(pixelKernelLevel()) + " pixel kernels)");
+	_mipTime.report(os, "Image mip chain time");
+	os << "Image compression: " << _compressedImages << " images BC1 compressed, " << _compressedDiskHits << " loaded compressed from disk" << std::endl;
+	_compressTime.report(os, "Image BC1 encode time");
+	auto perImage = _downloads ? (double)_downloadedBytes / (double)_downloads : 0.0;
+	os << "Image downloads: " << _downloadedBytes << " bytes for " << _downloads << " images, " << perImage << " bytes per image, "
+		<< perImage * TileData::visible_tiles * TileData::visible_tiles_horizontal << " bytes per screen" << std::endl;
+}
@@ -0,0 +1,133 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Stats.h"
+#include "ImageVariant.h"
+#include "BlockCompression.h"
+#include "FetchScheduler.h"
+
+//RGBA pixels, usually smaller than the source artwork (see decodeImage).  With more than one level
+//the pixels are a textureWidth x textureHeight mip atlas (see buildMipChain), width and height are level 0's.
+//BC1 images hold the atlas as compressed blocks rather than RGBA.
+struct DecodedImage
+{
+	std::unique_ptr<unsigned char[]> pixels;
+	TextureCompression compression = TextureCompression::None;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t textureWidth = 0;
+	uint32_t textureHeight = 0;
+	uint32_t levels = 1;
+	uint32_t sourceWidth = 0;
+	uint32_t sourceHeight = 0;
+
+	size_t bytes() const { return compression == TextureCompression::BC1 ? bc1Size(textureWidth, textureHeight) : (size_t)textureWidth * (size_t)textureHeight * 4; }
+	size_t sourceBytes() const { return (size_t)sourceWidth * (size_t)sourceHeight * 4; }
+};
+
+//Process wide cache of decoded tile artwork keyed by image URL.  Images are shared, so tiles
+//with the same artwork share one decode.  An image is pinned while anything outside the cache
+//holds it; unpinned images are evicted least recently used first once the budget is exceeded.
+class ImageCache
+{
+public:
+	using Image = std::shared_ptr<const DecodedImage>;
+
+	static constexpr inline size_t default_budget = 256ull * 1024ull * 1024ull;
+
+	static ImageCache& instance();
+
+	//Non-blocking lookup, returns nullptr on a miss
+	Image find(const std::string& url);
+
+	//Downloads on the fetch workers and decodes on the decode pool, the image (nullptr on failure)
+	//arrives on the returned handle.  Concurrent requests for one url share a load; if the request
+	//driving it is cancelled the next one still waiting takes it over rather than fail.
+	PendingFetch<Image> request(const std::string& url, FetchPriority priority);
+
+	//Pixel size tiles are drawn at, new decodes are reduced to it.  0 decodes at full size.
+	void setTargetSize(uint32_t width, uint32_t height);
+	void targetSize(uint32_t& width, uint32_t& height) const;
+
+	//New decodes get a full mip chain, built on the worker doing the decode
+	void setMipmaps(bool enabled);
+
+	//Opaque images are block compressed on the worker after decoding, and the blocks are kept in the
+	//disk cache next to the source so later launches skip the decode.  Off by default.
+	void setCompression(TextureCompression compression);
+
+	//Applied to image URLs when they are fetched, so the service sends artwork at the target width
+	void setUrlRewrite(ImageUrlRewrite rewrite);
+
+	void setBudget(size_t bytes);
+	size_t residentBytes() const;
+	void report(std::ostream& os) const;
+
+private:
+	ImageCache() = default;
+
+	struct Entry
+	{
+		Image image;
+		std::list<std::string>::iterator lru;
+	};
+
+	//A request waiting on a load, the first one's ticket drives it
+	struct Waiter
+	{
+		std::shared_ptr<FetchTicket> ticket;
+		std::promise<Image> promise;
+	};
+
+	//Settings read once per load, so the decode, the mip chain and the cache key agree even if they change meanwhile
+	struct LoadSettings
+	{
+		std::string fetchUrl;
+		uint32_t targetWidth = 0;
+		uint32_t targetHeight = 0;
+		bool mipmaps = true;
+		TextureCompression compression = TextureCompression::None;
+	};
+
+	void start(const std::string& url, std::shared_ptr<FetchTicket> ticket);
+	void fetch(const std::string& url, const std::shared_ptr<FetchTicket>& ticket);
+	Image decode(const std::vector<unsigned char>& data, const LoadSettings& settings);
+	void finish(const std::string& url, Image image);
+	void insert(const std::string& url, Image image);
+	void evict();
+
+	mutable std::mutex _mutex;
+	std::unordered_map<std::string, Entry> _entries;
+	std::list<std::string> _lru;
+	std::unordered_map<std::string, std::vector<Waiter>> _loading;
+	size_t _budget = default_budget;
+	size_t _residentBytes = 0;
+	std::atomic<uint32_t> _targetWidth{ 0 };
+	std::atomic<uint32_t> _targetHeight{ 0 };
+	std::atomic<bool> _mipmaps{ true };
+	std::atomic<TextureCompression> _compression{ TextureCompression::None };
+	ImageUrlRewrite _urlRewrite;
+
+	LatencyStats _decodeTime;
+	LatencyStats _mipTime;
+	LatencyStats _compressTime;
+	uint64_t _compressedImages = 0;
+	uint64_t _compressedDiskHits = 0;
+	uint64_t _decodedBytes = 0;
+	uint64_t _sourceBytes = 0;
+	uint64_t _downloads = 0;
+	uint64_t _downloadedBytes = 0;
+
+	uint64_t _hits = 0;
+	uint64_t _misses = 0;
+	uint64_t _evictions = 0;
+	uint64_t _cancelled = 0;
+};
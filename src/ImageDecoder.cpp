@@ -0,0 +1,225 @@
+#include "ImageDecoder.h"
+#include "ImageCache.h"
+#include "PixelKernels.h"
+#include "Stats.h"
+#include <vxt/PNGLoader.h>
+
+#include <algorithm>
+#include <chrono>
+#include <csetjmp>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+
+#include <jpeglib.h>
+
+namespace
+{
+	struct JpegError
+	{
+		jpeg_error_mgr manager;
+		jmp_buf jump;
+	};
+
+	void jpegErrorExit(j_common_ptr info)
+	{
+		longjmp(reinterpret_cast<JpegError*>(info->err)->jump, 1);
+	}
+
+	//warnings about corrupt data, libjpeg carries on and so do we
+	void jpegMessage(j_common_ptr, int) {}
+
+	//Largest DCT scale whose output still covers the target in both dimensions
+	unsigned int scaleFor(uint32_t width, uint32_t height, uint32_t targetWidth, uint32_t targetHeight)
+	{
+		for (unsigned int denominator : { 8u, 4u, 2u })
+		{
+			if ((width + denominator - 1) / denominator >= targetWidth && (height + denominator - 1) / denominator >= targetHeight)
+				return denominator;
+		}
+		return 1;
+	}
+
+	//Nothing with a destructor may live in this frame, libjpeg errors longjmp back into it
+	bool decodeJpeg(const unsigned char* data, size_t size, uint32_t targetWidth, uint32_t targetHeight, std::unique_ptr<unsigned char[]>& pixels, uint32_t& width, uint32_t& height, uint32_t& channels, DecodedImage& image)
+	{
+		jpeg_decompress_struct info;
+		JpegError error;
+		info.err = jpeg_std_error(&error.manager);
+		error.manager.error_exit = jpegErrorExit;
+		error.manager.emit_message = jpegMessage;
+		if (setjmp(error.jump))
+		{
+			jpeg_destroy_decompress(&info);
+			pixels.reset();
+			return false;
+		}
+
+		jpeg_create_decompress(&info);
+		jpeg_mem_src(&info, data, (unsigned long)size);
+		jpeg_read_header(&info, TRUE);
+
+		image.sourceWidth = info.image_width;
+		image.sourceHeight = info.image_height;
+		info.scale_num = 1;
+		info.scale_denom = scaleFor(info.image_width, info.image_height, targetWidth ? targetWidth : info.image_width, targetHeight ? targetHeight : info.image_height);
+#ifdef JCS_EXTENSIONS
+		info.out_color_space = JCS_EXT_RGBA;
+		channels = 4;
+#else
+		//plain libjpeg only writes RGB, the caller expands it
+		info.out_color_space = JCS_RGB;
+		channels = 3;
+#endif
+		jpeg_start_decompress(&info);
+
+		width = info.output_width;
+		height = info.output_height;
+		pixels.reset(new unsigned char[(size_t)width * height * channels]);
+		while (info.output_scanline < info.output_height)
+		{
+			JSAMPROW row = pixels.get() + (size_t)info.output_scanline * width * channels;
+			jpeg_read_scanlines(&info, &row, 1);
+		}
+
+		jpeg_finish_decompress(&info);
+		jpeg_destroy_decompress(&info);
+		return true;
+	}
+
+}
+
+void downsampleRGBA(const unsigned char* source, uint32_t sourceWidth, uint32_t sourceHeight, unsigned char* destination, uint32_t width, uint32_t height)
+{
+	//box filtered halvings while at least 2x too big, like building a mip chain, then one bilinear step
+	std::unique_ptr<unsigned char[]> halved;
+	while (sourceWidth / 2 >= width && sourceHeight / 2 >= height)
+	{
+		std::unique_ptr<unsigned char[]> next(new unsigned char[(size_t)(sourceWidth / 2) * (sourceHeight / 2) * 4]);
+		halveRGBA(source, sourceWidth, sourceHeight, next.get());
+		halved = std::move(next);
+		source = halved.get();
+		sourceWidth /= 2;
+		sourceHeight /= 2;
+	}
+
+	if (sourceWidth == width && sourceHeight == height)
+		std::memcpy(destination, source, (size_t)width * height * 4);
+	else
+		resizeBilinearRGBA(source, sourceWidth, sourceHeight, destination, width, height);
+}
+
+bool decodeImage(const unsigned char* data, size_t size, uint32_t targetWidth, uint32_t targetHeight, DecodedImage& image)
+{
+	std::unique_ptr<unsigned char[]> pixels;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t channels = 4;
+	if (decodeJpeg(data, size, targetWidth, targetHeight, pixels, width, height, channels, image))
+	{
+		if (channels == 3)
+		{
+			std::unique_ptr<unsigned char[]> expanded(new unsigned char[(size_t)width * height * 4]);
+			expandRGBToRGBA(pixels.get(), expanded.get(), (size_t)width * height);
+			pixels = std::move(expanded);
+		}
+	}
+	else
+	{
+		//PNGs and the JPEG flavours libjpeg turns down, decoded at full size
+		int fullWidth{ 0 }, fullHeight{ 0 }, sourceChannels{ 0 };
+		void* full = vxt::loadJPGData_fromMem(data, size, fullWidth, fullHeight, sourceChannels);
+		if (!full)
+			return false;
+		width = (uint32_t)fullWidth;
+		height = (uint32_t)fullHeight;
+		image.sourceWidth = width;
+		image.sourceHeight = height;
+		pixels.reset(new unsigned char[(size_t)width * height * 4]);
+		std::memcpy(pixels.get(), full, (size_t)width * height * 4);
+		vxt::freeJPGData(full);
+		//vxt always hands back RGBA.  Art with its own alpha is premultiplied so that filtering does not
+		//pull hidden colour out of transparent pixels, and the unblended tile quad shows them as black.
+		if (sourceChannels == 4)
+			premultiplyAlpha(pixels.get(), (size_t)width * height);
+	}
+
+	//never scaled up, the GPU's bilinear filter does that for free
+	auto finalWidth = targetWidth ? std::min(width, targetWidth) : width;
+	auto finalHeight = targetHeight ? std::min(height, targetHeight) : height;
+	if (finalWidth != width || finalHeight != height)
+	{
+		std::unique_ptr<unsigned char[]> reduced(new unsigned char[(size_t)finalWidth * finalHeight * 4]);
+		downsampleRGBA(pixels.get(), width, height, reduced.get(), finalWidth, finalHeight);
+		pixels = std::move(reduced);
+	}
+
+	image.pixels = std::move(pixels);
+	image.width = finalWidth;
+	image.height = finalHeight;
+	image.textureWidth = finalWidth;
+	image.textureHeight = finalHeight;
+	image.levels = 1;
+	return true;
+}
+
+void benchmarkDecode(const std::vector<std::string>& files, uint32_t targetWidth, uint32_t targetHeight, std::ostream& os)
+{
+	using clock = std::chrono::steady_clock;
+	constexpr int passes = 5;
+	auto milliseconds = [](clock::time_point begin) { return std::chrono::duration<double, std::milli>(clock::now() - begin).count(); };
+
+	LatencyStats full;
+	LatencyStats fullJpeg;
+	LatencyStats scaled;
+	size_t images = 0;
+	size_t fullBytes = 0;
+	size_t scaledBytes = 0;
+	for (auto&& file : files)
+	{
+		std::ifstream in(file, std::ios::binary);
+		std::vector<unsigned char> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		DecodedImage image;
+		if (data.empty() || !decodeImage(data.data(), data.size(), targetWidth, targetHeight, image))
+		{
+			os << "Decode benchmark: could not decode " << file << std::endl;
+			continue;
+		}
+		images++;
+		scaledBytes += image.bytes();
+		fullBytes += image.sourceBytes();
+
+		for (int pass = 0; pass < passes; ++pass)
+		{
+			auto begin = clock::now();
+			int width{ 0 }, height{ 0 }, channels{ 0 };
+			void* pixels = vxt::loadJPGData_fromMem(data.data(), data.size(), width, height, channels);
+			if (pixels)
+			{
+				full.record(milliseconds(begin));
+				vxt::freeJPGData(pixels);
+			}
+
+			//same decoder as the scaled path, so this is the saving from scaling alone
+			begin = clock::now();
+			DecodedImage whole;
+			decodeImage(data.data(), data.size(), 0, 0, whole);
+			fullJpeg.record(milliseconds(begin));
+
+			begin = clock::now();
+			DecodedImage reduced;
+			decodeImage(data.data(), data.size(), targetWidth, targetHeight, reduced);
+			scaled.record(milliseconds(begin));
+		}
+	}
+	if (!images)
+		return;
+
+	os << "Decode benchmark: " << images << " images, target " << targetWidth << "x" << targetHeight << std::endl;
+	if (full.count())
+		os << "  full size through vxt: p50 " << full.percentile(50.0) << " ms, p99 " << full.percentile(99.0) << " ms, " << fullBytes << " bytes resident" << std::endl;
+	os << "  full size through decodeImage: p50 " << fullJpeg.percentile(50.0) << " ms, p99 " << fullJpeg.percentile(99.0) << " ms, " << fullBytes << " bytes resident" << std::endl;
+	os << "  scaled to target: p50 " << scaled.percentile(50.0) << " ms, p99 " << scaled.percentile(99.0) << " ms, " << scaledBytes << " bytes resident" << std::endl;
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+struct DecodedImage;
+
+//Decodes tile artwork to RGBA at no more than the size it is drawn at.  JPEGs are decoded at the
+//smallest DCT scale (1/1, 1/2, 1/4 or 1/8) that still covers the target, then filtered down to it;
+//anything libjpeg cannot read goes through vxt at full size and is reduced the same way.
+//A target of 0 keeps that dimension at full size.
+bool decodeImage(const unsigned char* data, size_t size, uint32_t targetWidth, uint32_t targetHeight, DecodedImage& image);
+
+//Downsample of tightly packed RGBA: 2x2 box filtered halvings while the source is at least twice
+//the destination, then a bilinear step.  Destination dimensions must not exceed the source.
+void downsampleRGBA(const unsigned char* source, uint32_t sourceWidth, uint32_t sourceHeight, unsigned char* destination, uint32_t width, uint32_t height);
+
+//Decodes each image file at full size through vxt as tiles used to, at full size through decodeImage,
+//and at the target through decodeImage, reporting decode time and the bytes each way leaves resident
+void benchmarkDecode(const std::vector<std::string>& files, uint32_t targetWidth, uint32_t targetHeight, std::ostream& os);
@@ -0,0 +1,100 @@
+#include "ImageVariant.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+float ImageVariant::aspect() const
+{
+	if (masterWidth && masterHeight)
+		return (float)masterWidth / (float)masterHeight;
+	return std::strtof(aspectRatio.c_str(), nullptr);
+}
+
+const ImageVariant* selectImageVariant(const std::vector<ImageVariant>& variants, std::string_view kind, uint32_t targetWidth, uint32_t targetHeight)
+{
+	auto usable = [kind](const ImageVariant& variant) { return variant.kind == kind && !variant.url.empty(); };
+
+	const ImageVariant* best = nullptr;
+	if (!targetWidth || !targetHeight)
+	{
+		for (auto&& variant : variants)
+		{
+			if (usable(variant) && (!best || variant.aspectRatio > best->aspectRatio))
+				best = &variant;
+		}
+		return best;
+	}
+
+	//ratios are compared on a log scale so 2:1 too wide costs the same as 2:1 too tall
+	float targetAspect = (float)targetWidth / (float)targetHeight;
+	auto distance = [targetAspect](const ImageVariant& variant) {
+		float aspect = variant.aspect();
+		return aspect > 0.f ? std::fabs(std::log(aspect / targetAspect)) : INFINITY;
+	};
+	auto covers = [targetWidth, targetHeight](const ImageVariant& variant) {
+		//an unknown master size is assumed to be big enough
+		return !variant.masterWidth || (variant.masterWidth >= targetWidth && variant.masterHeight >= targetHeight);
+	};
+	auto pixels = [](const ImageVariant& variant) {
+		return (uint64_t)variant.masterWidth * variant.masterHeight;
+	};
+
+	float bestDistance = INFINITY;
+	for (auto&& variant : variants)
+	{
+		if (usable(variant))
+			bestDistance = std::min(bestDistance, distance(variant));
+	}
+
+	//ratios within a couple of percent of the best count as the same shape
+	constexpr float same_shape = .02f;
+	for (auto&& variant : variants)
+	{
+		if (!usable(variant) || distance(variant) > bestDistance + same_shape)
+			continue;
+		if (!best)
+			best = &variant;
+		else if (covers(variant) != covers(*best))
+			best = covers(variant) ? &variant : best;
+		else if (covers(variant) ? pixels(variant) < pixels(*best) : pixels(variant) > pixels(*best))
+			best = &variant;
+	}
+	return best;
+}
+
+std::string ImageUrlRewrite::apply(std::string_view url, uint32_t width) const
+{
+	if (parameter.empty() || !width)
+		return std::string(url);
+
+	if (granularity > 1)
+		width = (width + granularity - 1) / granularity * granularity;
+
+	auto queryBegin = url.find('?');
+	if (queryBegin != std::string_view::npos)
+	{
+		for (auto begin = queryBegin + 1; begin < url.size();)
+		{
+			auto end = std::min(url.find('&', begin), url.size());
+			auto field = url.substr(begin, end - begin);
+			if (field.size() > parameter.size() && field.substr(0, parameter.size()) == parameter && field[parameter.size()] == '=')
+			{
+				std::string rewritten(url.substr(0, begin + parameter.size() + 1));
+				rewritten += std::to_string(width);
+				rewritten += url.substr(end);
+				return rewritten;
+			}
+			begin = end + 1;
+		}
+	}
+
+	if (!appendIfMissing)
+		return std::string(url);
+
+	std::string rewritten(url);
+	rewritten += queryBegin == std::string_view::npos ? '?' : '&';
+	rewritten += parameter;
+	rewritten += '=';
+	rewritten += std::to_string(width);
+	return rewritten;
+}
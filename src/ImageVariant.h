@@ -0,0 +1,37 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+//One image.tile.<aspectRatio>.<kind>.default entry of a catalog item
+struct ImageVariant
+{
+	std::string aspectRatio;
+	std::string kind;
+	std::string url;
+	uint32_t masterWidth = 0;
+	uint32_t masterHeight = 0;
+
+	//From the master size when the catalog gives one, otherwise from the aspect ratio key
+	float aspect() const;
+};
+
+//The variant of `kind` whose aspect ratio is closest to the target, and of those the smallest
+//master that still covers it (or the largest, if none does).  Without a target the widest
+//aspect ratio is taken, as the catalog lists it last.
+const ImageVariant* selectImageVariant(const std::vector<ImageVariant>& variants, std::string_view kind, uint32_t targetWidth, uint32_t targetHeight);
+
+//Asks the image service for artwork already scaled to the drawn width by setting one query
+//parameter of the URL, e.g. ".../scale?format=jpeg&width=500".  Widths are rounded up to
+//`granularity` so small window resizes keep hitting the same disk cache entries.
+struct ImageUrlRewrite
+{
+	//An empty parameter leaves URLs untouched
+	std::string parameter = "width";
+	uint32_t granularity = 64;
+	//Add the parameter to URLs that do not have it, only for services known to understand it
+	bool appendIfMissing = false;
+
+	std::string apply(std::string_view url, uint32_t width) const;
+};
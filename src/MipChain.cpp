@@ -0,0 +1,128 @@
+#include "MipChain.h"
+#include "ImageCache.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+	//sRGB to linear at 16 bits and back; the reverse table has an entry for every 16 bit value so
+	//dark tones, where sRGB steps are smallest, keep all their precision
+	struct GammaTables
+	{
+		GammaTables() : toSrgb(65536)
+		{
+			for (int i = 0; i < 256; ++i)
+			{
+				double c = i / 255.0;
+				double linear = c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4);
+				toLinear[i] = (uint16_t)std::lround(linear * 65535.0);
+			}
+			for (int i = 0; i < 65536; ++i)
+			{
+				double linear = i / 65535.0;
+				double c = linear <= 0.0031308 ? linear * 12.92 : 1.055 * std::pow(linear, 1.0 / 2.4) - 0.055;
+				toSrgb[i] = (uint8_t)std::lround(std::clamp(c, 0.0, 1.0) * 255.0);
+			}
+		}
+
+		std::array<uint16_t, 256> toLinear;
+		std::vector<uint8_t> toSrgb;
+	};
+
+	const GammaTables& gamma()
+	{
+		static const GammaTables tables;
+		return tables;
+	}
+
+	uint32_t half(uint32_t size)
+	{
+		return std::max(1u, size / 2);
+	}
+
+	//2x2 box filter in linear light, alpha is coverage and averaged as is.  A dimension already at 1
+	//is not halved, the row or column is just reused.
+	void halveLinear(const unsigned char* source, uint32_t sourceWidth, uint32_t sourceHeight, size_t sourceStride, unsigned char* destination, size_t stride)
+	{
+		const auto& tables = gamma();
+		uint32_t width = half(sourceWidth);
+		uint32_t height = half(sourceHeight);
+		size_t down = sourceHeight > 1 ? sourceStride : 0;
+		size_t across = sourceWidth > 1 ? 4 : 0;
+		for (uint32_t y = 0; y < height; ++y)
+		{
+			const unsigned char* top = source + (size_t)y * (sourceHeight > 1 ? 2 : 1) * sourceStride;
+			const unsigned char* bottom = top + down;
+			unsigned char* out = destination + (size_t)y * stride;
+			for (uint32_t x = 0; x < width; ++x, out += 4)
+			{
+				size_t left = (size_t)x * (sourceWidth > 1 ? 8 : 4);
+				size_t right = left + across;
+				for (int c = 0; c < 3; ++c)
+				{
+					uint32_t sum = tables.toLinear[top[left + c]] + tables.toLinear[top[right + c]] + tables.toLinear[bottom[left + c]] + tables.toLinear[bottom[right + c]];
+					out[c] = tables.toSrgb[(sum + 2) >> 2];
+				}
+				out[3] = (unsigned char)((top[left + 3] + top[right + 3] + bottom[left + 3] + bottom[right + 3] + 2) >> 2);
+			}
+		}
+	}
+}
+
+uint32_t mipLevelCount(uint32_t width, uint32_t height)
+{
+	uint32_t levels = 1;
+	while (width > 1 || height > 1)
+	{
+		width = half(width);
+		height = half(height);
+		levels++;
+	}
+	return levels;
+}
+
+void buildMipChain(DecodedImage& image)
+{
+	uint32_t levels = mipLevelCount(image.width, image.height);
+	if (levels < 2)
+		return;
+
+	//the column of smaller levels is as wide as level 1 and as tall as they are together
+	uint32_t columnHeight = 0;
+	for (uint32_t level = 1, height = image.height; level < levels; ++level)
+	{
+		height = half(height);
+		columnHeight += height;
+	}
+	uint32_t atlasWidth = image.width + half(image.width);
+	uint32_t atlasHeight = std::max(image.height, columnHeight);
+	size_t stride = (size_t)atlasWidth * 4;
+
+	std::unique_ptr<unsigned char[]> atlas(new unsigned char[stride * atlasHeight]);
+	std::memset(atlas.get(), 0, stride * atlasHeight);
+	for (uint32_t y = 0; y < image.height; ++y)
+		std::memcpy(atlas.get() + y * stride, image.pixels.get() + (size_t)y * image.width * 4, (size_t)image.width * 4);
+
+	const unsigned char* source = atlas.get();
+	uint32_t sourceWidth = image.width;
+	uint32_t sourceHeight = image.height;
+	uint32_t y = 0;
+	for (uint32_t level = 1; level < levels; ++level)
+	{
+		unsigned char* destination = atlas.get() + y * stride + (size_t)image.width * 4;
+		halveLinear(source, sourceWidth, sourceHeight, stride, destination, stride);
+		source = destination;
+		sourceWidth = half(sourceWidth);
+		sourceHeight = half(sourceHeight);
+		y += sourceHeight;
+	}
+
+	image.pixels = std::move(atlas);
+	image.textureWidth = atlasWidth;
+	image.textureHeight = atlasHeight;
+	image.levels = levels;
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include <cstdint>
+
+struct DecodedImage;
+
+//Full mip chain of a decoded image, down to 1x1, packed into one RGBA texture: level 0 on the
+//left and every smaller level stacked top to bottom in a column to its right.  vkl uploads a
+//single level per texture, so ImagePlane's shader picks and blends the levels itself.
+//Levels are 2x2 box filtered in linear light, so bright detail does not darken as it shrinks.
+void buildMipChain(DecodedImage& image);
+
+//Number of levels a full chain of a width x height image has
+uint32_t mipLevelCount(uint32_t width, uint32_t height);
@@ -0,0 +1,566 @@
+#include "PixelKernels.h"
+#include "Stats.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define PIXEL_KERNELS_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+//MSVC hands out every intrinsic regardless of target, GCC and Clang need it per function
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE2
+#define TARGET_AVX2
+#endif
+
+namespace
+{
+	struct Kernels
+	{
+		PixelKernelLevel level;
+		void (*expandRGB)(const unsigned char* rgb, unsigned char* rgba, size_t pixels);
+		void (*expandAlpha)(const unsigned char* alpha, unsigned char* rgba, size_t pixels);
+		void (*fillAlpha)(unsigned char* rgba, size_t pixels, unsigned char alpha);
+		void (*premultiply)(unsigned char* rgba, size_t pixels);
+		//one destination row of a 2x2 box filter from the two source rows under it
+		void (*halveRow)(const unsigned char* top, const unsigned char* bottom, unsigned char* destination, size_t pixels);
+		//weight is bottom's share in 1/256ths
+		void (*blendRows)(const unsigned char* top, const unsigned char* bottom, unsigned char* destination, size_t bytes, uint32_t weight);
+	};
+
+	void expandRGBScalar(const unsigned char* rgb, unsigned char* rgba, size_t pixels)
+	{
+		for (size_t i = 0; i < pixels; ++i, rgb += 3, rgba += 4)
+		{
+			rgba[0] = rgb[0];
+			rgba[1] = rgb[1];
+			rgba[2] = rgb[2];
+			rgba[3] = 255;
+		}
+	}
+
+	void expandAlphaScalar(const unsigned char* alpha, unsigned char* rgba, size_t pixels)
+	{
+		for (size_t i = 0; i < pixels; ++i, rgba += 4)
+		{
+			rgba[0] = 255;
+			rgba[1] = 255;
+			rgba[2] = 255;
+			rgba[3] = alpha[i];
+		}
+	}
+
+	void fillAlphaScalar(unsigned char* rgba, size_t pixels, unsigned char alpha)
+	{
+		for (size_t i = 0; i < pixels; ++i)
+			rgba[i * 4 + 3] = alpha;
+	}
+
+	//c * a / 255 rounded to nearest, without a divide
+	inline unsigned char scaleByAlpha(uint32_t c, uint32_t a)
+	{
+		uint32_t t = c * a + 128;
+		return (unsigned char)((t + (t >> 8)) >> 8);
+	}
+
+	void premultiplyScalar(unsigned char* rgba, size_t pixels)
+	{
+		for (size_t i = 0; i < pixels; ++i, rgba += 4)
+		{
+			rgba[0] = scaleByAlpha(rgba[0], rgba[3]);
+			rgba[1] = scaleByAlpha(rgba[1], rgba[3]);
+			rgba[2] = scaleByAlpha(rgba[2], rgba[3]);
+		}
+	}
+
+	void halveRowScalar(const unsigned char* top, const unsigned char* bottom, unsigned char* destination, size_t pixels)
+	{
+		for (size_t i = 0; i < pixels; ++i, top += 8, bottom += 8, destination += 4)
+		{
+			for (int c = 0; c < 4; ++c)
+				destination[c] = (unsigned char)((top[c] + top[c + 4] + bottom[c] + bottom[c + 4] + 2) >> 2);
+		}
+	}
+
+	void blendRowsScalar(const unsigned char* top, const unsigned char* bottom, unsigned char* destination, size_t bytes, uint32_t weight)
+	{
+		for (size_t i = 0; i < bytes; ++i)
+			destination[i] = (unsigned char)((top[i] * (256 - weight) + bottom[i] * weight + 128) >> 8);
+	}
+
+	constexpr Kernels scalarKernels{ PixelKernelLevel::Scalar, expandRGBScalar, expandAlphaScalar, fillAlphaScalar, premultiplyScalar, halveRowScalar, blendRowsScalar };
+
+#if PIXEL_KERNELS_X86
+	TARGET_SSE2 void expandRGBSSE2(const unsigned char* rgb, unsigned char* rgba, size_t pixels)
+	{
+		//each 4 byte load takes the next pixel's red along, the alpha mask overwrites it.  The last
+		//pixel is left to the scalar tail so nothing past the end is read.
+		const __m128i alpha = _mm_set1_epi32((int)0xff000000);
+		size_t i = 0;
+		for (; i + 5 <= pixels; i += 4)
+		{
+			uint32_t p[4];
+			std::memcpy(&p[0], rgb + i * 3, 4);
+			std::memcpy(&p[1], rgb + i * 3 + 3, 4);
+			std::memcpy(&p[2], rgb + i * 3 + 6, 4);
+			std::memcpy(&p[3], rgb + i * 3 + 9, 4);
+			__m128i v = _mm_setr_epi32((int)p[0], (int)p[1], (int)p[2], (int)p[3]);
+			_mm_storeu_si128((__m128i*)(rgba + i * 4), _mm_or_si128(v, alpha));
+		}
+		expandRGBScalar(rgb + i * 3, rgba + i * 4, pixels - i);
+	}
+
+	TARGET_SSE2 void expandAlphaSSE2(const unsigned char* alpha, unsigned char* rgba, size_t pixels)
+	{
+		const __m128i white = _mm_set1_epi8((char)0xff);
+		size_t i = 0;
+		for (; i + 16 <= pixels; i += 16)
+		{
+			__m128i a = _mm_loadu_si128((const __m128i*)(alpha + i));
+			//byte pairs (255, a) then (255, 255, 255, a)
+			__m128i low = _mm_unpacklo_epi8(white, a);
+			__m128i high = _mm_unpackhi_epi8(white, a);
+			auto out = (__m128i*)(rgba + i * 4);
+			_mm_storeu_si128(out + 0, _mm_unpacklo_epi16(white, low));
+			_mm_storeu_si128(out + 1, _mm_unpackhi_epi16(white, low));
+			_mm_storeu_si128(out + 2, _mm_unpacklo_epi16(white, high));
+			_mm_storeu_si128(out + 3, _mm_unpackhi_epi16(white, high));
+		}
+		expandAlphaScalar(alpha + i, rgba + i * 4, pixels - i);
+	}
+
+	TARGET_SSE2 void fillAlphaSSE2(unsigned char* rgba, size_t pixels, unsigned char alpha)
+	{
+		const __m128i colour = _mm_set1_epi32(0x00ffffff);
+		const __m128i fill = _mm_set1_epi32((int)((uint32_t)alpha << 24));
+		size_t i = 0;
+		for (; i + 4 <= pixels; i += 4)
+		{
+			auto p = (__m128i*)(rgba + i * 4);
+			_mm_storeu_si128(p, _mm_or_si128(_mm_and_si128(_mm_loadu_si128(p), colour), fill));
+		}
+		fillAlphaScalar(rgba + i * 4, pixels - i, alpha);
+	}
+
+	//Two pixels widened to 16 bits per channel, alpha is multiplied by 255 so it comes out unchanged
+	TARGET_SSE2 inline __m128i premultiplyWide(__m128i pixels)
+	{
+		const __m128i colour = _mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1);
+		const __m128i opaque = _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0);
+		const __m128i half = _mm_set1_epi16(128);
+		__m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(pixels, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+		alpha = _mm_or_si128(_mm_and_si128(alpha, colour), opaque);
+		__m128i t = _mm_add_epi16(_mm_mullo_epi16(pixels, alpha), half);
+		return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+	}
+
+	TARGET_SSE2 void premultiplySSE2(unsigned char* rgba, size_t pixels)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		size_t i = 0;
+		for (; i + 4 <= pixels; i += 4)
+		{
+			auto p = (__m128i*)(rgba + i * 4);
+			__m128i v = _mm_loadu_si128(p);
+			__m128i low = premultiplyWide(_mm_unpacklo_epi8(v, zero));
+			__m128i high = premultiplyWide(_mm_unpackhi_epi8(v, zero));
+			_mm_storeu_si128(p, _mm_packus_epi16(low, high));
+		}
+		premultiplyScalar(rgba + i * 4, pixels - i);
+	}
+
+	//Vertical sums of two source pixels widened to 16 bits, folded so the low half holds their total
+	TARGET_SSE2 inline __m128i sumPairs(__m128i low, __m128i lowBelow)
+	{
+		__m128i sum = _mm_add_epi16(low, lowBelow);
+		return _mm_add_epi16(sum, _mm_srli_si128(sum, 8));
+	}
+
+	TARGET_SSE2 void halveRowSSE2(const unsigned char* top, const unsigned char* bottom, unsigned char* destination, size_t pixels)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i two = _mm_set1_epi16(2);
+		size_t i = 0;
+		for (; i + 4 <= pixels; i += 4)
+		{
+			__m128i a = _mm_loadu_si128((const __m128i*)(top + i * 8));
+			__m128i b = _mm_loadu_si128((const __m128i*)(top + i * 8 + 16));
+			__m128i c = _mm_loadu_si128((const __m128i*)(bottom + i * 8));
+			__m128i d = _mm_loadu_si128((const __m128i*)(bottom + i * 8 + 16));
+			__m128i first = _mm_unpacklo_epi64(sumPairs(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(c, zero)), sumPairs(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(c, zero)));
+			__m128i second = _mm_unpacklo_epi64(sumPairs(_mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(d, zero)), sumPairs(_mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(d, zero)));
+			first = _mm_srli_epi16(_mm_add_epi16(first, two), 2);
+			second = _mm_srli_epi16(_mm_add_epi16(second, two), 2);
+			_mm_storeu_si128((__m128i*)(destination + i * 4), _mm_packus_epi16(first, second));
+		}
+		halveRowScalar(top + i * 8, bottom + i * 8, destination + i * 4, pixels - i);
+	}
+
+	TARGET_SSE2 inline __m128i blendWide(__m128i top, __m128i bottom, __m128i topWeight, __m128i bottomWeight)
+	{
+		__m128i sum = _mm_add_epi16(_mm_mullo_epi16(top, topWeight), _mm_mullo_epi16(bottom, bottomWeight));
+		return _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(128)), 8);
+	}
+
+	TARGET_SSE2 void blendRowsSSE2(const unsigned char* top, const unsigned char* bottom, unsigned char* destination, size_t bytes, uint32_t weight)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i topWeight = _mm_set1_epi16((short)(256 - weight));
+		const __m128i bottomWeight = _mm_set1_epi16((short)weight);
+		size_t i = 0;
+		for (; i + 16 <= bytes; i += 16)
+		{
+			__m128i t = _mm_loadu_si128((const __m128i*)(top + i));
+			__m128i b = _mm_loadu_si128((const __m128i*)(bottom + i));
+			__m128i low = blendWide(_mm_unpacklo_epi8(t, zero), _mm_unpacklo_epi8(b, zero), topWeight, bottomWeight);
+			__m128i high = blendWide(_mm_unpackhi_epi8(t, zero), _mm_unpackhi_epi8(b, zero), topWeight, bottomWeight);
+			_mm_storeu_si128((__m128i*)(destination + i), _mm_packus_epi16(low, high));
+		}
+		blendRowsScalar(top + i, bottom + i, destination + i, bytes - i, weight);
+	}
+
+	constexpr Kernels sse2Kernels{ PixelKernelLevel::SSE2, expandRGBSSE2, expandAlphaSSE2, fillAlphaSSE2, premultiplySSE2, halveRowSSE2, blendRowsSSE2 };
+
+	TARGET_AVX2 void expandRGBAVX2(const unsigned char* rgb, unsigned char* rgba, size_t pixels)
+	{
+		//four pixels from each 16 byte load, the second load must stay inside the buffer
+		const __m256i spread = _mm256_setr_epi8(
+			0, 1, 2, -128, 3, 4, 5, -128, 6, 7, 8, -128, 9, 10, 11, -128,
+			0, 1, 2, -128, 3, 4, 5, -128, 6, 7, 8, -128, 9, 10, 11, -128);
+		const __m256i alpha = _mm256_set1_epi32((int)0xff000000);
+		size_t i = 0;
+		for (; i + 10 <= pixels; i += 8)
+		{
+			__m128i low = _mm_loadu_si128((const __m128i*)(rgb + i * 3));
+			__m128i high = _mm_loadu_si128((const __m128i*)(rgb + i * 3 + 12));
+			__m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1);
+			_mm256_storeu_si256((__m256i*)(rgba + i * 4), _mm256_or_si256(_mm256_shuffle_epi8(v, spread), alpha));
+		}
+		expandRGBSSE2(rgb + i * 3, rgba + i * 4, pixels - i);
+	}
+
+	TARGET_AVX2 void expandAlphaAVX2(const unsigned char* alpha, unsigned char* rgba, size_t pixels)
+	{
+		const __m256i white = _mm256_set1_epi32(0x00ffffff);
+		size_t i = 0;
+		for (; i + 8 <= pixels; i += 8)
+		{
+			__m256i a = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(alpha + i)));
+			_mm256_storeu_si256((__m256i*)(rgba + i * 4), _mm256_or_si256(_mm256_slli_epi32(a, 24), white));
+		}
+		expandAlphaScalar(alpha + i, rgba + i * 4, pixels - i);
+	}
+
+	TARGET_AVX2 void fillAlphaAVX2(unsigned char* rgba, size_t pixels, unsigned char alpha)
+	{
+		const __m256i colour = _mm256_set1_epi32(0x00ffffff);
+		const __m256i fill = _mm256_set1_epi32((int)((uint32_t)alpha << 24));
+		size_t i = 0;
+		for (; i + 8 <= pixels; i += 8)
+		{
+			auto p = (__m256i*)(rgba + i * 4);
+			_mm256_storeu_si256(p, _mm256_or_si256(_mm256_and_si256(_mm256_loadu_si256(p), colour), fill));
+		}
+		fillAlphaScalar(rgba + i * 4, pixels - i, alpha);
+	}
+
+	TARGET_AVX2 inline __m256i premultiplyWide(__m256i pixels)
+	{
+		const __m256i colour = _mm256_set_epi16(0, -1, -1, -1, 0, -1, -1, -1, 0, -1, -1, -1, 0, -1, -1, -1);
+		const __m256i opaque = _mm256_set_epi16(255, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0);
+		const __m256i half = _mm256_set1_epi16(128);
+		__m256i alpha = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(pixels, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+		alpha = _mm256_or_si256(_mm256_and_si256(alpha, colour), opaque);
+		__m256i t = _mm256_add_epi16(_mm256_mullo_epi16(pixels, alpha), half);
+		return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+	}
+
+	TARGET_AVX2 void premultiplyAVX2(unsigned char* rgba, size_t pixels)
+	{
+		//unpack and pack both work within 128 bit lanes, so pixels come back where they started
+		const __m256i zero = _mm256_setzero_si256();
+		size_t i = 0;
+		for (; i + 8 <= pixels; i += 8)
+		{
+			auto p = (__m256i*)(rgba + i * 4);
+			__m256i v = _mm256_loadu_si256(p);
+			__m256i low = premultiplyWide(_mm256_unpacklo_epi8(v, zero));
+			__m256i high = premultiplyWide(_mm256_unpackhi_epi8(v, zero));
+			_mm256_storeu_si256(p, _mm256_packus_epi16(low, high));
+		}
+		premultiplyScalar(rgba + i * 4, pixels - i);
+	}
+
+	TARGET_AVX2 inline __m256i sumPairs(__m256i low, __m256i lowBelow)
+	{
+		__m256i sum = _mm256_add_epi16(low, lowBelow);
+		return _mm256_add_epi16(sum, _mm256_srli_si256(sum, 8));
+	}
+
+	TARGET_AVX2 void halveRowAVX2(const unsigned char* top, const unsigned char* bottom, unsigned char* destination, size_t pixels)
+	{
+		const __m256i zero = _mm256_setzero_si256();
+		const __m256i two = _mm256_set1_epi16(2);
+		size_t i = 0;
+		for (; i + 8 <= pixels; i += 8)
+		{
+			__m256i a = _mm256_loadu_si256((const __m256i*)(top + i * 8));
+			__m256i b = _mm256_loadu_si256((const __m256i*)(top + i * 8 + 32));
+			__m256i c = _mm256_loadu_si256((const __m256i*)(bottom + i * 8));
+			__m256i d = _mm256_loadu_si256((const __m256i*)(bottom + i * 8 + 32));
+			//lanes hold destination pixels 0,1 | 2,3 and 4,5 | 6,7
+			__m256i first = _mm256_unpacklo_epi64(sumPairs(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(c, zero)), sumPairs(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(c, zero)));
+			__m256i second = _mm256_unpacklo_epi64(sumPairs(_mm256_unpacklo_epi8(b, zero), _mm256_unpacklo_epi8(d, zero)), sumPairs(_mm256_unpackhi_epi8(b, zero), _mm256_unpackhi_epi8(d, zero)));
+			first = _mm256_srli_epi16(_mm256_add_epi16(first, two), 2);
+			second = _mm256_srli_epi16(_mm256_add_epi16(second, two), 2);
+			//packing interleaves the lanes as 0,1 4,5 2,3 6,7
+			__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(first, second), _MM_SHUFFLE(3, 1, 2, 0));
+			_mm256_storeu_si256((__m256i*)(destination + i * 4), packed);
+		}
+		halveRowSSE2(top + i * 8, bottom + i * 8, destination + i * 4, pixels - i);
+	}
+
+	TARGET_AVX2 inline __m256i blendWide(__m256i top, __m256i bottom, __m256i topWeight, __m256i bottomWeight)
+	{
+		__m256i sum = _mm256_add_epi16(_mm256_mullo_epi16(top, topWeight), _mm256_mullo_epi16(bottom, bottomWeight));
+		return _mm256_srli_epi16(_mm256_add_epi16(sum, _mm256_set1_epi16(128)), 8);
+	}
+
+	TARGET_AVX2 void blendRowsAVX2(const unsigned char* top, const unsigned char* bottom, unsigned char* destination, size_t bytes, uint32_t weight)
+	{
+		const __m256i zero = _mm256_setzero_si256();
+		const __m256i topWeight = _mm256_set1_epi16((short)(256 - weight));
+		const __m256i bottomWeight = _mm256_set1_epi16((short)weight);
+		size_t i = 0;
+		for (; i + 32 <= bytes; i += 32)
+		{
+			__m256i t = _mm256_loadu_si256((const __m256i*)(top + i));
+			__m256i b = _mm256_loadu_si256((const __m256i*)(bottom + i));
+			__m256i low = blendWide(_mm256_unpacklo_epi8(t, zero), _mm256_unpacklo_epi8(b, zero), topWeight, bottomWeight);
+			__m256i high = blendWide(_mm256_unpackhi_epi8(t, zero), _mm256_unpackhi_epi8(b, zero), topWeight, bottomWeight);
+			_mm256_storeu_si256((__m256i*)(destination + i), _mm256_packus_epi16(low, high));
+		}
+		blendRowsSSE2(top + i, bottom + i, destination + i, bytes - i, weight);
+	}
+
+	constexpr Kernels avx2Kernels{ PixelKernelLevel::AVX2, expandRGBAVX2, expandAlphaAVX2, fillAlphaAVX2, premultiplyAVX2, halveRowAVX2, blendRowsAVX2 };
+#endif
+
+	PixelKernelLevel supportedLevel()
+	{
+#if PIXEL_KERNELS_X86
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 0);
+		int leaves = info[0];
+		__cpuid(info, 1);
+		bool sse2 = (info[3] & (1 << 26)) != 0;
+		//AVX state has to be enabled by the OS as well as present in the CPU
+		bool avx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+		if (avx && leaves >= 7)
+		{
+			__cpuidex(info, 7, 0);
+			if (info[1] & (1 << 5))
+				return PixelKernelLevel::AVX2;
+		}
+		if (sse2)
+			return PixelKernelLevel::SSE2;
+#else
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2"))
+			return PixelKernelLevel::AVX2;
+		if (__builtin_cpu_supports("sse2"))
+			return PixelKernelLevel::SSE2;
+#endif
+#endif
+		return PixelKernelLevel::Scalar;
+	}
+
+	const Kernels* kernelsFor(PixelKernelLevel level)
+	{
+#if PIXEL_KERNELS_X86
+		if (level == PixelKernelLevel::AVX2)
+			return &avx2Kernels;
+		if (level == PixelKernelLevel::SSE2)
+			return &sse2Kernels;
+#endif
+		return &scalarKernels;
+	}
+
+	std::atomic<const Kernels*>& activeKernels()
+	{
+		static std::atomic<const Kernels*> kernels{ kernelsFor(supportedLevel()) };
+		return kernels;
+	}
+
+	const Kernels& kernels()
+	{
+		return *activeKernels().load(std::memory_order_relaxed);
+	}
+}
+
+PixelKernelLevel pixelKernelLevel()
+{
+	return kernels().level;
+}
+
+void setPixelKernelLevel(PixelKernelLevel level)
+{
+	activeKernels() = kernelsFor(std::min(level, supportedLevel()));
+}
+
+const char* pixelKernelLevelName(PixelKernelLevel level)
+{
+	switch (level)
+	{
+	case PixelKernelLevel::AVX2: return "AVX2";
+	case PixelKernelLevel::SSE2: return "SSE2";
+	default: return "scalar";
+	}
+}
+
+void expandRGBToRGBA(const unsigned char* rgb, unsigned char* rgba, size_t pixels)
+{
+	kernels().expandRGB(rgb, rgba, pixels);
+}
+
+void expandAlphaToRGBA(const unsigned char* alpha, unsigned char* rgba, size_t pixels)
+{
+	kernels().expandAlpha(alpha, rgba, pixels);
+}
+
+void fillAlpha(unsigned char* rgba, size_t pixels, unsigned char alpha)
+{
+	kernels().fillAlpha(rgba, pixels, alpha);
+}
+
+void premultiplyAlpha(unsigned char* rgba, size_t pixels)
+{
+	kernels().premultiply(rgba, pixels);
+}
+
+void halveRGBA(const unsigned char* source, uint32_t width, uint32_t height, unsigned char* destination)
+{
+	auto& k = kernels();
+	size_t sourceStride = (size_t)width * 4;
+	size_t stride = (size_t)(width / 2) * 4;
+	for (uint32_t y = 0; y < height / 2; ++y)
+	{
+		const unsigned char* top = source + (size_t)y * 2 * sourceStride;
+		k.halveRow(top, top + sourceStride, destination + (size_t)y * stride, width / 2);
+	}
+}
+
+void resizeBilinearRGBA(const unsigned char* source, uint32_t sourceWidth, uint32_t sourceHeight, unsigned char* destination, uint32_t width, uint32_t height)
+{
+	//sample position of an output pixel centre, split into a source index and a 1/256th fraction
+	auto sample = [](uint32_t d, uint32_t source, uint32_t destination, uint32_t& index, uint32_t& fraction) {
+		double position = std::max(0.0, (d + .5) * source / destination - .5);
+		index = std::min((uint32_t)position, source - 1);
+		fraction = index + 1 < source ? (uint32_t)std::lround((position - index) * 256.0) : 0;
+	};
+
+	std::vector<uint32_t> columns(width);
+	std::vector<uint32_t> columnWeights(width);
+	for (uint32_t x = 0; x < width; ++x)
+		sample(x, sourceWidth, width, columns[x], columnWeights[x]);
+
+	//the vertical blend is the vector part, the horizontal one is a gather and stays scalar
+	auto& k = kernels();
+	size_t sourceStride = (size_t)sourceWidth * 4;
+	std::vector<unsigned char> blended(sourceStride + 4);
+	for (uint32_t y = 0; y < height; ++y)
+	{
+		uint32_t row, rowWeight;
+		sample(y, sourceHeight, height, row, rowWeight);
+		const unsigned char* top = source + (size_t)row * sourceStride;
+		k.blendRows(top, rowWeight ? top + sourceStride : top, blended.data(), sourceStride, rowWeight);
+
+		unsigned char* out = destination + (size_t)y * width * 4;
+		for (uint32_t x = 0; x < width; ++x, out += 4)
+		{
+			const unsigned char* left = blended.data() + (size_t)columns[x] * 4;
+			uint32_t weight = columnWeights[x];
+			for (int c = 0; c < 4; ++c)
+				out[c] = (unsigned char)((left[c] * (256 - weight) + left[c + 4] * weight + 128) >> 8);
+		}
+	}
+}
+
+void benchmarkPixelKernels(std::ostream& os)
+{
+	constexpr uint32_t width = 1920;
+	constexpr uint32_t height = 1080;
+	constexpr size_t pixels = (size_t)width * height;
+	constexpr int passes = 20;
+
+	std::vector<unsigned char> rgb(pixels * 3);
+	std::vector<unsigned char> alpha(pixels);
+	std::vector<unsigned char> rgba(pixels * 4);
+	std::vector<unsigned char> destination(pixels * 4);
+	for (size_t i = 0; i < rgb.size(); ++i)
+		rgb[i] = (unsigned char)(i * 7 + i / 4096);
+	for (size_t i = 0; i < alpha.size(); ++i)
+		alpha[i] = (unsigned char)(i * 13);
+	expandRGBToRGBA(rgb.data(), rgba.data(), pixels);
+
+	struct Kernel
+	{
+		const char* name;
+		//bytes read per run, what MB/s is counted in
+		size_t bytes;
+		std::function<void()> run;
+	};
+	const Kernel kernels[] = {
+		{ "expand RGB to RGBA", pixels * 3, [&]() { expandRGBToRGBA(rgb.data(), destination.data(), pixels); } },
+		{ "expand alpha to RGBA", pixels, [&]() { expandAlphaToRGBA(alpha.data(), destination.data(), pixels); } },
+		{ "fill alpha", pixels * 4, [&]() { fillAlpha(destination.data(), pixels, 255); } },
+		//in place, so each run starts from a fresh copy and the copy is timed too
+		{ "premultiply alpha", pixels * 4, [&]() { std::memcpy(destination.data(), rgba.data(), pixels * 4); premultiplyAlpha(destination.data(), pixels); } },
+		{ "2x2 box halve", pixels * 4, [&]() { halveRGBA(rgba.data(), width, height, destination.data()); } },
+		{ "bilinear to 1280x720", pixels * 4, [&]() { resizeBilinearRGBA(rgba.data(), width, height, destination.data(), 1280, 720); } },
+	};
+
+	auto previous = pixelKernelLevel();
+	auto supported = supportedLevel();
+	os << "Pixel kernel benchmark: " << width << "x" << height << ", best of " << passes << " runs, up to " << pixelKernelLevelName(supported) << std::endl;
+	for (auto&& kernel : kernels)
+	{
+		os << "  " << kernel.name << ":";
+		double scalar = 0.0;
+		for (auto level : { PixelKernelLevel::Scalar, PixelKernelLevel::SSE2, PixelKernelLevel::AVX2 })
+		{
+			if (level > supported)
+				break;
+			setPixelKernelLevel(level);
+			double best = 1e9;
+			for (int pass = 0; pass < passes; ++pass)
+			{
+				auto begin = std::chrono::steady_clock::now();
+				kernel.run();
+				best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count());
+			}
+			double megabytes = (double)kernel.bytes / (1024.0 * 1024.0) / best;
+			if (level == PixelKernelLevel::Scalar)
+				scalar = megabytes;
+			os << " " << pixelKernelLevelName(level) << " " << (int)megabytes << " MB/s";
+			if (level != PixelKernelLevel::Scalar)
+				os << " (" << megabytes / scalar << "x)";
+		}
+		os << std::endl;
+	}
+	setPixelKernelLevel(previous);
+}
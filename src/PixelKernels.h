@@ -0,0 +1,35 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+//Per pixel loops that get decoded artwork and glyphs into the 8 bit RGBA layout textures are
+//uploaded in.  Each has scalar, SSE2 and AVX2 versions; the widest one the CPU runs is picked the
+//first time any of them is called.
+enum class PixelKernelLevel
+{
+	Scalar,
+	SSE2,
+	AVX2,
+};
+
+PixelKernelLevel pixelKernelLevel();
+//Caps the level used from now on, mostly to compare them.  Levels the CPU lacks are never used.
+void setPixelKernelLevel(PixelKernelLevel level);
+const char* pixelKernelLevelName(PixelKernelLevel level);
+
+//RGB to RGBA with opaque alpha, the buffers must not overlap
+void expandRGBToRGBA(const unsigned char* rgb, unsigned char* rgba, size_t pixels);
+//Single channel coverage to white RGBA with the coverage as alpha
+void expandAlphaToRGBA(const unsigned char* alpha, unsigned char* rgba, size_t pixels);
+void fillAlpha(unsigned char* rgba, size_t pixels, unsigned char alpha);
+//Scales colour by alpha, rounded to nearest
+void premultiplyAlpha(unsigned char* rgba, size_t pixels);
+
+//2x2 box filter into (width / 2) x (height / 2), an odd last row or column is dropped
+void halveRGBA(const unsigned char* source, uint32_t width, uint32_t height, unsigned char* destination);
+//Bilinear resample with pixel centres lined up, only suited to reductions of less than 2x
+void resizeBilinearRGBA(const unsigned char* source, uint32_t sourceWidth, uint32_t sourceHeight, unsigned char* destination, uint32_t width, uint32_t height);
+
+//Times each kernel on a 1080p frame at every level the CPU runs, reporting MB/s and the gain over scalar
+void benchmarkPixelKernels(std::ostream& os);
@@ -1,58 +1,617 @@
 #include "RemoteAccess.h"
+#include "Stats.h"
+#include "DiskCache.h"
+#include "FetchScheduler.h"
 #include <curl/curl.h>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
 #include <iostream>
+#include <istream>
+#include <mutex>
+#include <thread>
+
 namespace
 {
+    //One transfer on the client's shared multi handle.  Its callbacks run on the transfer thread; the
+    //thread that asked for it waits on done, or reads pending as it arrives when streaming.
+    struct Transfer
+    {
+        CURL* curl = nullptr;
+        //taken on the asking thread, the callbacks can't see its thread-local ticket
+        const FetchTicket* ticket = nullptr;
+        const HttpClient::DataSink* sink = nullptr;
+        bool streaming = false;
+
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::string pending;
+        bool done = false;
+        CURLcode result = CURLE_OK;
+        std::atomic<bool> abort{ false };
+
+        bool statusChecked = false;
+        long rejectedStatus = 0;
+
+        bool cancelled() const { return ticket && ticket->cancelled(); }
+
+        //Error bodies are never handed on, so a 404 page can't end up parsed or cached as the resource
+        bool acceptStatus()
+        {
+            if (!statusChecked)
+            {
+                statusChecked = true;
+                long status = 0;
+                curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+                if (status < 200 || status >= 300)
+                    rejectedStatus = status;
+            }
+            return rejectedStatus == 0;
+        }
+
+        void wait()
+        {
+            std::unique_lock lock(mutex);
+            changed.wait(lock, [this]() { return done; });
+        }
+    };
+
     size_t WriteCallback(void* contents, size_t size, size_t nmemb, void* userp)
     {
-        void* data = *static_cast<void**>(userp);
-        ((std::string*)userp)->append((char*)contents, size * nmemb);
+        auto& transfer = *static_cast<Transfer*>(userp);
+        if (transfer.cancelled() || transfer.abort || !transfer.acceptStatus())
+            return 0;
+        if (!transfer.streaming)
+            return (*transfer.sink)((const char*)contents, size * nmemb) ? size * nmemb : 0;
+
+        std::lock_guard lock(transfer.mutex);
+        transfer.pending.append((const char*)contents, size * nmemb);
+        transfer.changed.notify_all();
         return size * nmemb;
     }
-    size_t WriteCallbackImage(void* contents, size_t size, size_t nmemb, void* userp)
+
+    //Also fires while connecting or waiting on the server, so a cancelled fetch aborts even when no bytes arrive
+    int ProgressCallback(void* userp, curl_off_t, curl_off_t, curl_off_t, curl_off_t)
     {
-        std::vector<unsigned char>& data = *static_cast<std::vector<unsigned char>*>(userp);
-        size_t oldSize = data.size();
-        data.resize(data.size() + size * nmemb);
-        memcpy(data.data() + oldSize, contents, size * nmemb);
-        return size * nmemb;
+        auto& transfer = *static_cast<Transfer*>(userp);
+        return transfer.cancelled() || transfer.abort ? 1 : 0;
+    }
+
+    bool startsWithNoCase(std::string_view line, std::string_view prefix)
+    {
+        if (line.size() < prefix.size())
+            return false;
+        for (size_t i = 0; i < prefix.size(); ++i)
+        {
+            if (std::tolower((unsigned char)line[i]) != std::tolower((unsigned char)prefix[i]))
+                return false;
+        }
+        return true;
+    }
+
+    std::string headerValue(std::string_view line, std::string_view name)
+    {
+        line.remove_prefix(name.size());
+        while (!line.empty() && (line.front() == ' ' || line.front() == '\t'))
+            line.remove_prefix(1);
+        while (!line.empty() && (line.back() == '\r' || line.back() == '\n' || line.back() == ' '))
+            line.remove_suffix(1);
+        return std::string(line);
+    }
+
+    size_t HeaderCallback(char* buffer, size_t size, size_t nitems, void* userp)
+    {
+        auto& response = *static_cast<HttpClient::Response*>(userp);
+        std::string_view line(buffer, size * nitems);
+        if (startsWithNoCase(line, "ETag:"))
+            response.etag = headerValue(line, "ETag:");
+        else if (startsWithNoCase(line, "Last-Modified:"))
+            response.lastModified = headerValue(line, "Last-Modified:");
+        return size * nitems;
+    }
+
+    //Serves a string held in memory through std::istream without copying it
+    class MemoryStreamBuf : public std::streambuf
+    {
+    public:
+        explicit MemoryStreamBuf(std::string& data)
+        {
+            setg(data.data(), data.data(), data.data() + data.size());
+        }
+    };
+
+    //Reads a streaming transfer as the transfer thread receives it.  Each chunk goes to tee on the
+    //reading thread before the reader sees it.
+    class HttpStreamBuf : public std::streambuf
+    {
+    public:
+        HttpStreamBuf(Transfer& transfer, const HttpClient::DataSink& tee) : _transfer(transfer), _tee(tee) {}
+
+    protected:
+        int_type underflow() override
+        {
+            if (gptr() < egptr())
+                return traits_type::to_int_type(*gptr());
+
+            _current.clear();
+            {
+                std::unique_lock lock(_transfer.mutex);
+                _transfer.changed.wait(lock, [this]() { return !_transfer.pending.empty() || _transfer.done; });
+                std::swap(_current, _transfer.pending);
+            }
+            if (_current.empty())
+                return traits_type::eof();
+            if (_tee && !_tee(_current.data(), _current.size()))
+            {
+                _transfer.abort = true;
+                return traits_type::eof();
+            }
+
+            setg(_current.data(), _current.data(), _current.data() + _current.size());
+            return traits_type::to_int_type(*gptr());
+        }
+
+    private:
+        Transfer& _transfer;
+        const HttpClient::DataSink& _tee;
+        std::string _current;
+    };
+
+    std::vector<std::string> conditionalHeaders(const DiskCache::Entry& entry)
+    {
+        std::vector<std::string> headers;
+        if (!entry.etag.empty())
+            headers.push_back("If-None-Match: " + entry.etag);
+        if (!entry.lastModified.empty())
+            headers.push_back("If-Modified-Since: " + entry.lastModified);
+        return headers;
+    }
+
+    void revalidate(const std::string& url, const DiskCache::Entry& entry)
+    {
+        if (!DiskCache::instance().claimRevalidation(url))
+            return;
+
+        FetchScheduler::instance().submit(FetchPriority::Prefetch, [url, entry]() {
+            std::string body;
+            HttpClient::Response response;
+            bool ok = HttpClient::instance().get(url.c_str(), [&body](const char* data, size_t size) {
+                body.append(data, size);
+                return true;
+                }, &response, conditionalHeaders(entry));
+
+            if (ok && response.status == 304)
+                DiskCache::instance().touch(url);
+            else if (ok && response.status == 200 && !body.empty())
+                DiskCache::instance().store(url, body, { response.etag, response.lastModified });
+            }).detach();
+    }
+
+    bool loadCached(const char* url, std::string& body)
+    {
+        DiskCache::Entry entry;
+        if (!DiskCache::instance().load(url, body, entry))
+            return false;
+        revalidate(url, entry);
+        return true;
+    }
+
+    void storeFetched(const char* url, const std::string& body, const HttpClient::Response& response)
+    {
+        if (response.status != 200 || body.empty())
+            return;
+        //just fetched, nothing to revalidate this run
+        DiskCache::instance().claimRevalidation(url);
+        DiskCache::instance().store(url, body, { response.etag, response.lastModified });
+    }
+
+    bool fetchResource(const char* url, std::string& output)
+    {
+        if (loadCached(url, output))
+            return true;
+
+        HttpClient::Response response;
+        bool ok = HttpClient::instance().get(url, [&output](const char* data, size_t size) {
+            output.append(data, size);
+            return true;
+            }, &response);
+        if (!ok || response.status < 200 || response.status >= 300)
+        {
+            output.clear();
+            return false;
+        }
+        storeFetched(url, output, response);
+        return true;
     }
 }
 
-std::string receiveStringResource(const char* url)
+struct HttpClient::Impl
 {
-    CURL* curl;
-    CURLcode res;
-    curl = curl_easy_init();
-    std::string output;
-    if (curl) {
+    CURLSH* share = nullptr;
+    std::mutex shareLocks[CURL_LOCK_DATA_LAST];
+
+    std::mutex poolMutex;
+    std::vector<CURL*> idleHandles;
+
+    //Every transfer runs on one multi handle, so concurrent fetches to the same host are multiplexed
+    //as HTTP/2 streams on one connection instead of each opening its own
+    CURLM* multi = nullptr;
+    std::thread transferThread;
+    std::mutex queueMutex;
+    std::vector<Transfer*> queued;
+    bool stopping = false;
+
+    std::atomic<uint64_t> requests{ 0 };
+    std::atomic<uint64_t> connects{ 0 };
+    std::atomic<uint64_t> bytes{ 0 };
+    std::atomic<uint64_t> cancelled{ 0 };
+    std::atomic<uint64_t> rejected{ 0 };
+    LatencyStats latency;
+
+    static void lock(CURL*, curl_lock_data data, curl_lock_access, void* userp)
+    {
+        static_cast<Impl*>(userp)->shareLocks[data].lock();
+    }
+    static void unlock(CURL*, curl_lock_data data, void* userp)
+    {
+        static_cast<Impl*>(userp)->shareLocks[data].unlock();
+    }
+
+    CURL* acquire()
+    {
+        {
+            std::lock_guard lock(poolMutex);
+            if (!idleHandles.empty())
+            {
+                CURL* curl = idleHandles.back();
+                idleHandles.pop_back();
+                return curl;
+            }
+        }
+        return curl_easy_init();
+    }
+
+    void release(CURL* curl)
+    {
+        //reset keeps the handle's live connections and caches
+        curl_easy_reset(curl);
+        std::lock_guard lock(poolMutex);
+        idleHandles.push_back(curl);
+    }
+
+    void configure(Transfer& transfer, const char* url, Response* response)
+    {
+        CURL* curl = transfer.curl;
+        curl_easy_setopt(curl, CURLOPT_SHARE, share);
+        curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+        curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+        //wait for a connection being set up to the same host rather than opening a second one
+        curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+        curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
         curl_easy_setopt(curl, CURLOPT_URL, url);
+        curl_easy_setopt(curl, CURLOPT_PRIVATE, &transfer);
         curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &output);
-        res = curl_easy_perform(curl);
-        /* always cleanup */
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &transfer);
+        curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, ProgressCallback);
+        curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &transfer);
+        curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+        if (response)
+        {
+            curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, HeaderCallback);
+            curl_easy_setopt(curl, CURLOPT_HEADERDATA, response);
+        }
+    }
+
+    //Hands the transfer to the transfer thread, it is done once transfer.done is set
+    void start(Transfer& transfer)
+    {
+        {
+            std::lock_guard lock(queueMutex);
+            queued.push_back(&transfer);
+        }
+        curl_multi_wakeup(multi);
+    }
+
+    void run()
+    {
+        while (true)
+        {
+            {
+                std::lock_guard lock(queueMutex);
+                if (stopping)
+                    return;
+                for (auto&& transfer : queued)
+                    curl_multi_add_handle(multi, transfer->curl);
+                queued.clear();
+            }
+
+            int running = 0;
+            curl_multi_perform(multi, &running);
+
+            int remaining = 0;
+            while (CURLMsg* message = curl_multi_info_read(multi, &remaining))
+            {
+                if (message->msg != CURLMSG_DONE)
+                    continue;
+                CURL* curl = message->easy_handle;
+                CURLcode result = message->data.result;
+                Transfer* transfer = nullptr;
+                curl_easy_getinfo(curl, CURLINFO_PRIVATE, &transfer);
+                curl_multi_remove_handle(multi, curl);
+
+                std::lock_guard lock(transfer->mutex);
+                transfer->result = result;
+                transfer->done = true;
+                transfer->changed.notify_all();
+            }
+
+            //start() wakes the poll early
+            curl_multi_poll(multi, nullptr, 0, 1000, nullptr);
+        }
+    }
+
+    //Records the transfer's stats and turns the result into success or failure
+    bool finish(Transfer& transfer, std::chrono::steady_clock::time_point begin, Response* response)
+    {
+        CURL* curl = transfer.curl;
+        long status = 0;
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+        if (response)
+            response->status = status;
+        //304 is only ever asked for by revalidation, which handles it
+        if (transfer.result == CURLE_OK && status != 304 && (status < 200 || status >= 300))
+            transfer.rejectedStatus = status;
+
+        long newConnects = 0;
+        curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &newConnects);
+        curl_off_t received = 0;
+        curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &received);
+
+        requests++;
+        connects += (uint64_t)newConnects;
+        bytes += (uint64_t)received;
+        latency.record(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count());
+
+        if (transfer.cancelled())
+        {
+            cancelled++;
+            return false;
+        }
+        if (transfer.rejectedStatus)
+        {
+            rejected++;
+            std::cerr << "HTTP status " << transfer.rejectedStatus << std::endl;
+            return false;
+        }
+        if (transfer.result != CURLcode::CURLE_OK)
+        {
+            std::cerr << "CURL failure " << curl_easy_strerror(transfer.result) << std::endl;
+            return false;
+        }
+        return true;
+    }
+};
+
+HttpClient::HttpClient() : _impl(std::make_unique<Impl>())
+{
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    _impl->share = curl_share_init();
+    curl_share_setopt(_impl->share, CURLSHOPT_LOCKFUNC, &Impl::lock);
+    curl_share_setopt(_impl->share, CURLSHOPT_UNLOCKFUNC, &Impl::unlock);
+    curl_share_setopt(_impl->share, CURLSHOPT_USERDATA, _impl.get());
+    curl_share_setopt(_impl->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+    curl_share_setopt(_impl->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(_impl->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+
+    _impl->multi = curl_multi_init();
+    curl_multi_setopt(_impl->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    _impl->transferThread = std::thread([impl = _impl.get()]() { impl->run(); });
+}
+
+HttpClient::~HttpClient()
+{
+    {
+        std::lock_guard lock(_impl->queueMutex);
+        _impl->stopping = true;
+    }
+    curl_multi_wakeup(_impl->multi);
+    _impl->transferThread.join();
+    curl_multi_cleanup(_impl->multi);
+
+    for (auto&& curl : _impl->idleHandles)
         curl_easy_cleanup(curl);
+    _impl->idleHandles.clear();
+    curl_share_cleanup(_impl->share);
+    curl_global_cleanup();
+}
+
+HttpClient& HttpClient::instance()
+{
+    static HttpClient client;
+    return client;
+}
+
+bool HttpClient::get(const char* url, const DataSink& sink, Response* response, const std::vector<std::string>& headers)
+{
+    Transfer transfer;
+    transfer.curl = _impl->acquire();
+    if (!transfer.curl)
+        return false;
+    transfer.ticket = FetchTicket::current();
+    transfer.sink = &sink;
+
+    auto begin = std::chrono::steady_clock::now();
+
+    _impl->configure(transfer, url, response);
+
+    curl_slist* headerList = nullptr;
+    for (auto&& header : headers)
+        headerList = curl_slist_append(headerList, header.c_str());
+    if (headerList)
+        curl_easy_setopt(transfer.curl, CURLOPT_HTTPHEADER, headerList);
+
+    _impl->start(transfer);
+    transfer.wait();
+    bool ok = _impl->finish(transfer, begin, response);
+
+    _impl->release(transfer.curl);
+    curl_slist_free_all(headerList);
+    return ok;
+}
+
+bool HttpClient::stream(const char* url, const StreamReader& reader, const DataSink& tee, Response* response)
+{
+    Transfer transfer;
+    transfer.curl = _impl->acquire();
+    if (!transfer.curl)
+        return false;
+    transfer.ticket = FetchTicket::current();
+    transfer.streaming = true;
+
+    auto begin = std::chrono::steady_clock::now();
+
+    HttpStreamBuf buffer(transfer, tee);
+    _impl->configure(transfer, url, response);
+    _impl->start(transfer);
+
+    {
+        std::istream stream(&buffer);
+        reader(stream);
     }
-    return output;
+
+    //a reader that stopped early leaves the transfer unfinished, which counts as a failure
+    bool finished = false;
+    {
+        std::lock_guard lock(transfer.mutex);
+        finished = transfer.done && !transfer.abort;
+    }
+    transfer.abort = true;
+    transfer.wait();
+    bool ok = _impl->finish(transfer, begin, response) && finished;
+
+    _impl->release(transfer.curl);
+    return ok;
 }
 
-std::vector<unsigned char>  receiveImageData(const char* url)
+void HttpClient::benchmark(const char* url, size_t fetches, std::ostream& os)
 {
-    CURL* curl;
-    CURLcode res;
-    curl = curl_easy_init();
-    std::vector<unsigned char> output;
-    if (curl) {
+    using clock = std::chrono::steady_clock;
+    auto discard = [](void*, size_t size, size_t nmemb, void*) { return size * nmemb; };
+
+    //a handle of its own per fetch, as every fetch was made before connections were shared
+    LatencyStats fresh;
+    long freshConnects = 0;
+    for (size_t i = 0; i < fetches; ++i)
+    {
+        auto begin = clock::now();
+        CURL* curl = curl_easy_init();
         curl_easy_setopt(curl, CURLOPT_URL, url);
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallbackImage);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &output);
-        res = curl_easy_perform(curl);
-        if (res != CURLcode::CURLE_OK)
-        {
-            std::cerr << "CURL failure " << curl_easy_strerror(res);
-        }
-        /* always cleanup */
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, +discard);
+        curl_easy_perform(curl);
+        long newConnects = 0;
+        curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &newConnects);
+        freshConnects += newConnects;
         curl_easy_cleanup(curl);
+        fresh.record(std::chrono::duration<double, std::milli>(clock::now() - begin).count());
+    }
+
+    auto& client = instance();
+    uint64_t connects = client._impl->connects;
+    uint64_t rejected = client._impl->rejected;
+    LatencyStats shared;
+    size_t failed = 0;
+    for (size_t i = 0; i < fetches; ++i)
+    {
+        auto begin = clock::now();
+        if (!client.get(url, [](const char*, size_t) { return true; }))
+            failed++;
+        shared.record(std::chrono::duration<double, std::milli>(clock::now() - begin).count());
     }
+    connects = client._impl->connects - connects;
+    rejected = client._impl->rejected - rejected;
+
+    os << "HTTP benchmark: " << fetches << " sequential fetches of " << url << std::endl;
+    os << "  handle per fetch: " << (double)freshConnects / (double)fetches << " handshakes/request, p50 "
+        << fresh.percentile(50.0) << " ms, p99 " << fresh.percentile(99.0) << " ms" << std::endl;
+    os << "  shared client: " << (double)connects / (double)fetches << " handshakes/request, p50 "
+        << shared.percentile(50.0) << " ms, p99 " << shared.percentile(99.0) << " ms, "
+        << failed << " failed (" << rejected << " non-2xx)" << std::endl;
+}
+
+void HttpClient::report(std::ostream& os) const
+{
+    uint64_t requests = _impl->requests;
+    uint64_t connects = _impl->connects;
+    os << "HTTP: " << requests << " requests, " << connects << " new connections ("
+        << (requests ? (double)connects / (double)requests : 0.0) << " handshakes/request), "
+        << _impl->bytes << " bytes, " << _impl->cancelled << " cancelled, " << _impl->rejected << " non-2xx" << std::endl;
+    _impl->latency.report(os, "HTTP fetch latency");
+}
+
+std::string receiveStringResource(const char* url)
+{
+    std::string output;
+    fetchResource(url, output);
     return output;
 }
+
+std::vector<unsigned char> receiveImageData(const char* url)
+{
+    std::string output;
+    fetchResource(url, output);
+    return std::vector<unsigned char>(output.begin(), output.end());
+}
+
+bool streamResource(const char* url, const HttpClient::StreamReader& reader)
+{
+    std::string body;
+    if (loadCached(url, body))
+    {
+        MemoryStreamBuf buffer(body);
+        std::istream stream(&buffer);
+        reader(stream);
+        return true;
+    }
+
+    HttpClient::Response response;
+    bool ok = HttpClient::instance().stream(url, reader, [&body](const char* data, size_t size) {
+        body.append(data, size);
+        return true;
+        }, &response);
+    if (!ok || response.status < 200 || response.status >= 300)
+        return false;
+    storeFetched(url, body, response);
+    return true;
+}
+
+bool revalidateResource(const char* url, std::string& body, bool& modified)
+{
+    std::string cached;
+    DiskCache::Entry entry;
+    bool haveCached = DiskCache::instance().load(url, cached, entry);
+
+    std::string fetched;
+    HttpClient::Response response;
+    bool ok = HttpClient::instance().get(url, [&fetched](const char* data, size_t size) {
+        fetched.append(data, size);
+        return true;
+        }, &response, haveCached ? conditionalHeaders(entry) : std::vector<std::string>());
+    if (!ok)
+        return false;
+
+    if (response.status == 304 && haveCached)
+    {
+        DiskCache::instance().touch(url);
+        body = std::move(cached);
+        modified = false;
+        return true;
+    }
+    if (response.status != 200)
+        return false;
+
+    storeFetched(url, fetched, response);
+    body = std::move(fetched);
+    modified = true;
+    return true;
+}
@@ -1,7 +1,64 @@
 #pragma once
+#include <functional>
+#include <istream>
+#include <memory>
+#include <ostream>
 #include <string>
 #include <vector>
 
+//Process wide HTTP client.  Connections, DNS lookups and TLS sessions are shared between
+//requests so repeated fetches from the same CDN host skip the TCP/TLS handshake, and all transfers
+//run on one multi handle so concurrent ones multiplex over HTTP/2.  Responses outside 2xx fail
+//(304 excepted, for revalidation) and their bodies are never handed to the sink.
+class HttpClient
+{
+public:
+    //Return false to abort the transfer
+    using DataSink = std::function<bool(const char* data, size_t size)>;
+    using StreamReader = std::function<void(std::istream& body)>;
+
+    struct Response
+    {
+        long status = 0;
+        std::string etag;
+        std::string lastModified;
+    };
+
+    static HttpClient& instance();
+
+    bool get(const char* url, const DataSink& sink, Response* response = nullptr, const std::vector<std::string>& headers = {});
+
+    //Runs reader on the calling thread while the body downloads, so it can work through the body as it
+    //arrives.  Each chunk is also handed to tee (if set) first.
+    bool stream(const char* url, const StreamReader& reader, const DataSink& tee = {}, Response* response = nullptr);
+
+    void report(std::ostream& os) const;
+
+    //Sequential fetches of url, first with a fresh handle each then through the shared client,
+    //reporting handshakes per request and p50/p99 latency
+    static void benchmark(const char* url, size_t fetches, std::ostream& os);
+
+    ~HttpClient();
+    HttpClient(const HttpClient&) = delete;
+    HttpClient& operator=(const HttpClient&) = delete;
+
+private:
+    HttpClient();
+
+    struct Impl;
+    std::unique_ptr<Impl> _impl;
+};
+
+//Both serve a cached copy from DiskCache when there is one (revalidating it in the background)
+//and fall back to the network otherwise
 std::string receiveStringResource(const char* uri);
 
-std::vector<unsigned char> receiveImageData(const char* uri);
\ No newline at end of file
+std::vector<unsigned char> receiveImageData(const char* uri);
+
+//Hands the body to reader while it downloads so parsing overlaps the transfer, or straight from
+//DiskCache when it is cached
+bool streamResource(const char* uri, const HttpClient::StreamReader& reader);
+
+//Always asks the server, sending the cached copy's validators.  On a 304 body is the cached copy and
+//modified is false, on a 200 the cache is updated first.
+bool revalidateResource(const char* uri, std::string& body, bool& modified);
@@ -0,0 +1,43 @@
+#include "RenderObjectPool.h"
+
+std::shared_ptr<TextBox> RenderObjectPool::acquireTextBox(const vkl::Device& device, const vkl::SwapChain& swapChain, const vkl::PipelineManager& pipelines, vkl::BufferManager& bufferManager)
+{
+	if (_textBoxes.empty())
+	{
+		_textBoxesCreated++;
+		return std::make_shared<TextBox>(device, swapChain, pipelines, bufferManager);
+	}
+	_textBoxesReused++;
+	auto textBox = std::move(_textBoxes.back());
+	_textBoxes.pop_back();
+	return textBox;
+}
+
+void RenderObjectPool::release(std::shared_ptr<TextBox> textBox)
+{
+	if (!textBox)
+		return;
+	if (_textBoxes.size() >= _textBoxCapacity)
+	{
+		_dropped++;
+		return;
+	}
+	textBox->setText({});
+	textBox->setBackground({ 0.f, 0.f, 0.f, 0.f });
+	textBox->setSize({ 1.f, 1.f });
+	textBox->setMaxLength(TextBox::default_max_length);
+	_textBoxes.push_back(std::move(textBox));
+}
+
+void RenderObjectPool::setCapacity(size_t textBoxes)
+{
+	_textBoxCapacity = textBoxes;
+	if (_textBoxes.size() > _textBoxCapacity)
+		_textBoxes.resize(_textBoxCapacity);
+}
+
+void RenderObjectPool::report(std::ostream& os) const
+{
+	os << "Render object pool: " << _textBoxesCreated << " text boxes created, " << _textBoxesReused << " reused, " << _textBoxes.size() << " pooled, "
+		<< _dropped << " dropped over capacity" << std::endl;
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <memory>
+#include <ostream>
+#include <vector>
+#include "TextBox.h"
+
+//Keeps the text boxes that leave the window so the next row to come in rebinds one, rather than
+//every scroll step freeing GPU buffers and allocating new ones.  Pooled text boxes are blank: no
+//text, default style.  Beyond capacity they are just dropped.  Tiles need no pool, their image
+//planes hold no GPU objects of their own.
+class RenderObjectPool
+{
+public:
+	static constexpr inline size_t default_text_box_capacity = 16;
+
+	std::shared_ptr<TextBox> acquireTextBox(const vkl::Device& device, const vkl::SwapChain& swapChain, const vkl::PipelineManager& pipelines, vkl::BufferManager& bufferManager);
+
+	//Only once nothing else draws it, it has to be out of the render object list already
+	void release(std::shared_ptr<TextBox> textBox);
+
+	void setCapacity(size_t textBoxes);
+
+	void report(std::ostream& os) const;
+
+private:
+	std::vector<std::shared_ptr<TextBox>> _textBoxes;
+	size_t _textBoxCapacity = default_text_box_capacity;
+
+	uint64_t _textBoxesCreated = 0;
+	uint64_t _textBoxesReused = 0;
+	uint64_t _dropped = 0;
+};
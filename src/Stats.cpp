@@ -0,0 +1,136 @@
+#include "Stats.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#endif
+
+namespace
+{
+	const auto ProcessStart = std::chrono::steady_clock::now();
+	std::atomic<uint64_t> BufferAllocations{ 0 };
+	std::atomic<uint64_t> Uploads{ 0 };
+
+#ifndef _WIN32
+	//VmRSS / VmHWM lines of /proc/self/status, in kB
+	size_t procStatus(const char* field)
+	{
+		std::ifstream status("/proc/self/status");
+		std::string line;
+		while (std::getline(status, line))
+		{
+			if (line.compare(0, std::strlen(field), field) == 0)
+				return (size_t)std::stoull(line.substr(std::strlen(field))) * 1024;
+		}
+		return 0;
+	}
+#endif
+}
+
+std::chrono::steady_clock::time_point processStart()
+{
+	return ProcessStart;
+}
+
+void countBufferAllocations(uint64_t buffers)
+{
+	BufferAllocations += buffers;
+}
+
+uint64_t bufferAllocations()
+{
+	return BufferAllocations;
+}
+
+void countUploads(uint64_t uploads)
+{
+	Uploads += uploads;
+}
+
+uint64_t uploads()
+{
+	return Uploads;
+}
+
+size_t residentBytes()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters{};
+	return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ? counters.WorkingSetSize : 0;
+#else
+	return procStatus("VmRSS:");
+#endif
+}
+
+size_t peakResidentBytes()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters{};
+	return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ? counters.PeakWorkingSetSize : 0;
+#else
+	return procStatus("VmHWM:");
+#endif
+}
+
+bool resetPeakResidentBytes()
+{
+#ifdef _WIN32
+	return false;
+#else
+	std::ofstream clear("/proc/self/clear_refs");
+	clear << "5";
+	clear.flush();
+	return (bool)clear;
+#endif
+}
+
+void LatencyStats::record(double milliseconds)
+{
+	std::lock_guard lock(_mutex);
+	if (_samples.size() < max_samples)
+		_samples.push_back(milliseconds);
+	else
+		_samples[_next] = milliseconds;
+	_next = (_next + 1) % max_samples;
+	_total++;
+	_max = std::max(_max, milliseconds);
+}
+
+size_t LatencyStats::count() const
+{
+	std::lock_guard lock(_mutex);
+	return _total;
+}
+
+double LatencyStats::percentile(double p) const
+{
+	std::vector<double> sorted;
+	{
+		std::lock_guard lock(_mutex);
+		sorted = _samples;
+	}
+	if (sorted.empty())
+		return 0.0;
+
+	std::sort(sorted.begin(), sorted.end());
+	auto index = (size_t)std::ceil(p / 100.0 * (double)sorted.size());
+	return sorted[std::min(sorted.size() - 1, index > 0 ? index - 1 : 0)];
+}
+
+void LatencyStats::report(std::ostream& os, std::string_view name) const
+{
+	double max = 0.0;
+	{
+		std::lock_guard lock(_mutex);
+		max = _max;
+	}
+	os << name << ": " << count() << " samples, p50 " << percentile(50.0) << "ms, p99 " << percentile(99.0) << "ms, max " << max << "ms" << std::endl;
+}
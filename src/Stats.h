@@ -0,0 +1,45 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+//Keeps the most recent max_samples measurements
+class LatencyStats
+{
+public:
+	static constexpr inline size_t max_samples = 1 << 16;
+
+	void record(double milliseconds);
+
+	size_t count() const;
+	double percentile(double p) const;
+
+	void report(std::ostream& os, std::string_view name) const;
+
+private:
+	mutable std::mutex _mutex;
+	std::vector<double> _samples;
+	size_t _next = 0;
+	size_t _total = 0;
+	double _max = 0.0;
+};
+
+//Taken during static initialization, before main runs
+std::chrono::steady_clock::time_point processStart();
+
+//GPU buffers (vertex, index, uniform and texture) created for render objects, counted where they are created
+void countBufferAllocations(uint64_t buffers);
+uint64_t bufferAllocations();
+
+//Process resident set size now and at its highest, 0 where the platform doesn't say.  Resetting the
+//high-water mark is only possible on Linux; false elsewhere.
+size_t residentBytes();
+size_t peakResidentBytes();
+bool resetPeakResidentBytes();
+
+//Data handed to those buffers, a texture's creation included, counted where it is set
+void countUploads(uint64_t uploads);
+uint64_t uploads();
@@ -1,5 +1,7 @@
 
 #include "TextBox.h"
+#include "PixelKernels.h"
+#include "Stats.h"
 
 #include <array>
 #include <filesystem>
@@ -86,17 +88,8 @@ void main() {
 			{
 				unsigned char* output = &m_data[(y * m_width * 4) + (offset * 4)];
 				unsigned char* input = &data[y * width];
-				for (int x = 0; x < width; ++x)
-				{
-					//Work around VKL not supporting other texture formats yet - TODO
-					output[0] = (unsigned char)255;
-					output[1] = (unsigned char)255;
-					output[2] = (unsigned char)255;
-					output[3] = *input;
-					output += 4;
-					++input;
-				}
-				//memcpy(output, input, width);
+				//Work around VKL not supporting other texture formats yet - TODO
+				expandAlphaToRGBA(input, output, width);
 			}
 
 		}
@@ -221,10 +214,14 @@ TextBox::TextBox(const vkl::Device& device, const vkl::SwapChain& swapChain, con
 
 	_uniform = bufferManager.createTypedUniform<glm::vec4>(device, swapChain);
 	addUniform(_uniform, 1);
+	countBufferAllocations(3);
+	countUploads(1);
 
 }
 void TextBox::setText(std::string_view text)
 {
+	if (text == _text)
+		return;
 	_text = text;
 	_textDirty = true;
 }
@@ -234,6 +231,8 @@ std::string_view TextBox::getText() const
 }
 void TextBox::setPosition(const glm::vec2& ndc)
 {
+	if (ndc == _position)
+		return;
 	_position = ndc;
 	_positionDirty = true;
 }
@@ -243,6 +242,8 @@ glm::vec2 TextBox::getPosition() const
 }
 void TextBox::setSize(const glm::vec2& pixels)
 {
+	if (pixels == _size)
+		return;
 	_size = pixels;
 	_textDirty = true;
 }
@@ -253,11 +254,15 @@ glm::vec2 TextBox::getSize() const
 
 void TextBox::setMaxLength(float pixels)
 {
+	if (pixels == _maxLength)
+		return;
 	_maxLength = pixels;
 	_positionDirty = true;
 }
 void TextBox::setBackground(const glm::vec4& bg)
 {
+	if (bg == _background)
+		return;
 	_background = bg;
 	_positionDirty = true;
 }
@@ -359,7 +364,7 @@ void TextBox::update(const glm::vec4& viewport)
 		_vbo->setData(_vertexData.data(), sizeof(Vertex), _vertexData.size());
 		_drawCall->setCount((uint32_t)_vertexData.size());
 		_uniform->setData(viewport);
-
+		countUploads(2);
 	}
 
 	_lastViewport = viewport;
@@ -39,6 +39,7 @@ public:
 	void update(const glm::vec4& view);
 
 	static constexpr inline int typical_title_font_size = 32;
+	static constexpr inline float default_max_length = 800.f;
 
 private:
 	std::string _text;
@@ -52,7 +53,7 @@ private:
 
 	glm::vec4 _background{ 0,0,0,0 };
 
-	float _maxLength = 800.f;
+	float _maxLength = default_max_length;
 	
 	std::vector<Vertex> _vertexData;
 	std::shared_ptr<vkl::VertexBuffer> _vbo;
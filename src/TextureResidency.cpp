@@ -0,0 +1,138 @@
+#include "TextureResidency.h"
+#include "TileBatch.h"
+
+#include <algorithm>
+#include <cassert>
+
+void TextureResidency::setDistance(int tiles)
+{
+	_distance = std::max(0, tiles);
+}
+
+void TextureResidency::setBudget(size_t bytes)
+{
+	_budget = bytes;
+}
+
+void TextureResidency::track(Tile& tile, FetchPriority priority, int priorityDistance, int windowDistance)
+{
+	_slots.push_back({ &tile, priority, priorityDistance, windowDistance });
+}
+
+void TextureResidency::retire(Tile& tile)
+{
+	auto& plane = *tile._imagePlane;
+	if (!plane.imageRequested())
+		return;
+	if (auto bytes = plane.textureBytes())
+	{
+		_evictions++;
+		_evictedBytes += bytes;
+	}
+	else if (!plane.hasImage())
+	{
+		_cancelledLoads++;
+	}
+}
+
+void TextureResidency::evict(Slot& slot)
+{
+	retire(*slot.tile);
+	slot.tile->_imagePlane->releaseImage();
+}
+
+void TextureResidency::update(const TileBatch& batch)
+{
+	//budget evictions go down to here and loads stop short of it, so a tile evicted for room is not loaded straight back
+	size_t lowWater = _budget - _budget / 8;
+
+	size_t textures = 0;
+	size_t pending = 0;
+	size_t failed = 0;
+	std::vector<Slot*> loaded;
+	std::vector<Slot*> wanted;
+	for (auto& slot : _slots)
+	{
+		auto& plane = *slot.tile->_imagePlane;
+		if (!plane.imageRequested())
+		{
+			if (slot.windowDistance <= _distance)
+				wanted.push_back(&slot);
+			continue;
+		}
+
+		if (slot.windowDistance > _distance)
+		{
+			evict(slot);
+			continue;
+		}
+
+		//failed loads hold no texture and are not waited on, they retry once released
+		if (plane.loadFailed())
+		{
+			failed++;
+			continue;
+		}
+
+		if (plane.textureBytes())
+		{
+			textures++;
+			loaded.push_back(&slot);
+		}
+		else
+		{
+			pending++;
+		}
+	}
+
+	//an eviction frees exactly its own texture, so only as many go as it takes to get under the low water mark
+	size_t resident = batch.residentBytes();
+	if (resident > _budget)
+	{
+		std::sort(loaded.begin(), loaded.end(), [](const Slot* a, const Slot* b) { return a->windowDistance > b->windowDistance; });
+		for (auto* slot : loaded)
+		{
+			if (resident <= lowWater || slot->windowDistance == 0)
+				break;
+			size_t freed = slot->tile->_imagePlane->textureBytes();
+			textures--;
+			evict(*slot);
+			_budgetEvictions++;
+			resident -= freed;
+		}
+		assert(resident == batch.residentBytes());
+	}
+
+	//loads in flight are taken to be the size of the textures already resident
+	size_t textureBytes = textures ? resident / textures : 0;
+	auto projected = [&](size_t loads) {
+		return resident + loads * textureBytes;
+	};
+	std::stable_sort(wanted.begin(), wanted.end(), [](const Slot* a, const Slot* b) { return a->windowDistance < b->windowDistance; });
+	for (auto* slot : wanted)
+	{
+		if (slot->windowDistance > 0 && projected(pending + 1) > lowWater)
+			break;
+		bool restream = slot->tile->_imagePlane->wasReleased();
+		if (slot->tile->requestImage(slot->priority, slot->priorityDistance))
+		{
+			pending++;
+			if (restream)
+				_restreams++;
+		}
+	}
+
+	_residentBytes = resident;
+	_residentTextures = textures;
+	_failedLoads = failed;
+	_peakResidentBytes = std::max(_peakResidentBytes, resident);
+	_slots.clear();
+}
+
+void TextureResidency::report(std::ostream& os) const
+{
+	os << "Texture residency: " << _residentTextures << " textures, " << _residentBytes << "/" << _budget << " bytes of textures resident, "
+		<< _peakResidentBytes << " peak, within " << _distance << " tiles of the window" << std::endl;
+	os << "Texture evictions: " << _evictions << " (" << _budgetEvictions << " over budget), " << _evictedBytes << " bytes, "
+		<< _cancelledLoads << " loads cancelled, " << _restreams << " re-streamed, " << _failedLoads << " failed loads in range" << std::endl;
+}
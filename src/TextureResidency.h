@@ -0,0 +1,59 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+#include "Tile.h"
+
+class TileBatch;
+
+//Keeps tile textures on the GPU only near the visible window.  Tiles further than the distance
+//from it give their texture and decoded image back, and load again through the image cache when
+//they come back in range.  Over the budget the furthest textures go first, and new loads wait
+//for room, except for visible tiles which always load.
+class TextureResidency
+{
+public:
+	static constexpr inline int default_distance = 1;
+	static constexpr inline size_t default_budget = 256ull * 1024 * 1024;
+
+	void setDistance(int tiles);
+	void setBudget(size_t bytes);
+
+	//Every tile with an image plane, each frame, with how many rows or columns it is outside the visible window
+	void track(Tile& tile, FetchPriority priority, int priorityDistance, int windowDistance);
+	//A tile about to lose its image plane, counted as an eviction
+	void retire(Tile& tile);
+	//Evicts and requests for the tiles tracked since the last call
+	void update(const TileBatch& batch);
+
+	size_t residentBytes() const { return _residentBytes; }
+	uint64_t evictions() const { return _evictions; }
+
+	void report(std::ostream& os) const;
+
+private:
+	struct Slot
+	{
+		Tile* tile;
+		FetchPriority priority;
+		int priorityDistance;
+		int windowDistance;
+	};
+
+	void evict(Slot& slot);
+
+	int _distance = default_distance;
+	size_t _budget = default_budget;
+	std::vector<Slot> _slots;
+
+	size_t _residentBytes = 0;
+	size_t _peakResidentBytes = 0;
+	size_t _residentTextures = 0;
+	uint64_t _evictions = 0;
+	uint64_t _budgetEvictions = 0;
+	uint64_t _evictedBytes = 0;
+	uint64_t _cancelledLoads = 0;
+	size_t _failedLoads = 0;
+	uint64_t _restreams = 0;
+};
@@ -1,227 +1,285 @@
 #include "Tile.h"
 #include <vxt/PNGLoader.h>
 #include <vxt/LinearAlgebra.h>
-#include <vkl/PipelineFactory.h>
-#include <vkl/BufferManager.h>
-#include <vkl/Pipeline.h>
-#include <vkl/VertexBuffer.h>
-#include <vkl/DrawCall.h>
-#include <vkl/IndexBuffer.h>
 
 #include "RemoteAccess.h"
+#include "TileStrings.h"
+#include "Stats.h"
 
+#include <algorithm>
+#include <cstdio>
 #include <iostream>
 
-namespace
+void TileData::setTitle(std::string_view title)
 {
-	constexpr const char* VertShader = R"Shader(
-
-#version 450
-
-layout(binding = 0) uniform MVP {
-	mat4 model;
-	float selected;
-} u_mvp;
-
-layout(location = 0) in vec2 inPosition;
-layout(location = 1) in vec2 inUV;
-
-layout(location = 0) out vec2 fragUV;
-
-void main() {
-	vec2 position = inPosition;
-
-    gl_Position = u_mvp.model * vec4(position, 0.0, 1.0);
-    fragUV = inUV;
+	auto stored = TileStrings::instance().store(title);
+	_title = stored.data();
+	_titleLength = (uint32_t)stored.size();
 }
-)Shader";
-	constexpr const char* FragShader = R"Shader(
-
-#version 450
-
-layout(binding = 0) uniform MVP {
-	mat4 model;
-	float selected;
-} u_mvp;
-
-layout(binding = 1) uniform sampler2D texSampler;
 
-layout(location = 0) in vec2 fragUV;
-
-layout(location = 0) out vec4 outColor;
+std::string TileData::imageURL() const
+{
+	auto& strings = TileStrings::instance();
+	std::string url(strings.interned(_imageHead));
+	url.append(_imageId, _imageIdLength);
+	url += strings.interned(_imageTail);
+	return url;
+}
 
-void main() {
-	
-    outColor = texture(texSampler, fragUV);
+void TileData::setImageURL(std::string_view url)
+{
+	auto pathBegin = url.find("://");
+	pathBegin = url.find('/', pathBegin == std::string_view::npos ? 0 : pathBegin + 3);
+	auto pathEnd = std::min(url.find('?'), url.size());
 
-	if(u_mvp.selected > 0.f)
+	size_t idBegin = url.size();
+	size_t idEnd = url.size();
+	while (pathBegin < pathEnd)
 	{
-		if(fragUV.x < .01 || fragUV.x >.99 || fragUV.y < .01 || fragUV.y > .99)
-			outColor = vec4(1,1,1,1);
-		else if(fragUV.x < .02 || fragUV.x >.98 || fragUV.y < .02 || fragUV.y > .98)
-			outColor = vec4(0,0,0,1);
+		auto segmentBegin = pathBegin + 1;
+		auto segmentEnd = std::min(url.find('/', segmentBegin), pathEnd);
+		if (idBegin == url.size() || segmentEnd - segmentBegin > idEnd - idBegin)
+		{
+			idBegin = segmentBegin;
+			idEnd = segmentEnd;
+		}
+		pathBegin = segmentEnd;
 	}
 
-	gl_FragDepth=.5f;
+	auto& strings = TileStrings::instance();
+	_imageHead = strings.intern(url.substr(0, idBegin));
+	auto id = strings.store(url.substr(idBegin, idEnd - idBegin));
+	_imageId = id.data();
+	_imageIdLength = (uint32_t)id.size();
+	_imageTail = strings.intern(url.substr(idEnd));
 }
-)Shader";
 
-	static const unsigned char whitePixel[4] = { 255, 255,255, 255 };
-	static const ImagePlane::ImageData s_defaultImage = { (void*)whitePixel, 1, 1 };
+void TileData::setContentId(std::string_view contentId)
+{
+	//FNV-1a
+	_contentKey = 14695981039346656037ull;
+	for (unsigned char c : contentId)
+	{
+		_contentKey ^= c;
+		_contentKey *= 1099511628211ull;
+	}
 }
 
-REGISTER_PIPELINE(ImagePlane, ImagePlane::describePipeline)
-
-
-
-void ImagePlane::describePipeline(vkl::PipelineDescription& description)
+std::string_view TileData::language() const
 {
-	description.setPrimitiveTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
-
-	description.addShaderGLSL(VK_SHADER_STAGE_VERTEX_BIT, VertShader);
-	description.addShaderGLSL(VK_SHADER_STAGE_FRAGMENT_BIT, FragShader);
-
-	description.declareVertexAttribute(0, 0, VK_FORMAT_R32G32_SFLOAT, sizeof(Vertex), offsetof(Vertex, pos));
-	description.declareVertexAttribute(0, 1, VK_FORMAT_R32G32_SFLOAT, sizeof(Vertex), offsetof(Vertex, uv));
-
-	description.declareUniform(0, sizeof(glm::mat4));
-
-	description.declareTexture(1);
-
-	//description.setDepthOp(VK_COMPARE_OP_ALWAYS);
+	return TileStrings::instance().tag(_language);
 }
 
-ImagePlane::ImagePlane(const vkl::Device& device, const vkl::SwapChain& swapChain, const vkl::PipelineManager& pipelines, vkl::BufferManager& bufferManager)
+void TileData::setLanguage(std::string_view language)
 {
-	init(device, swapChain, bufferManager);
-	auto texBuff = bufferManager.createTextureBuffer(device, swapChain, s_defaultImage.data, (size_t)s_defaultImage.width, (size_t)s_defaultImage.height, 4);
-	addTexture(texBuff, 1);
+	_language = TileStrings::instance().internTag(language);
 }
 
-void ImagePlane::setImage(const std::string& url)
+std::string_view TileData::rating() const
 {
-	assert(!_imageData.data);
-	_imageFuture = std::move(std::async(std::launch::async | std::launch::deferred, [url]() -> ImageData {
-		
-		auto jpegData = receiveImageData(url.c_str());
-		if (jpegData.empty())
-			return {};
+	return TileStrings::instance().tag(_rating);
+}
 
-		ImageData retData;
-		int width{ 0 }, height{ 0 }, channels{ 0 };
-		retData.data = vxt::loadJPGData_fromMem(jpegData.data(), jpegData.size(), width, height, channels);
-		retData.width = (uint32_t)width;
-		retData.height = (uint32_t)height;
-		
-		return retData;
-		}));
+void TileData::setRating(std::string_view rating)
+{
+	_rating = TileStrings::instance().internTag(rating);
 }
 
-void ImagePlane::setSelected(bool selected)
+std::string_view TileData::typeName() const
 {
-	_selected = selected;
-	auto finalTransform = _transform;
-	if (_selected)
+	switch (_type)
 	{
-		finalTransform = glm::scale(finalTransform, { 1.2, 1.2, 1.2 });
+	case Type::Series:
+		return "Series";
+	case Type::Movie:
+		return "Movie";
+	case Type::Collection:
+		return "Collection";
 	}
-	_uniform->setData({ finalTransform, _selected ? 1.f : 0.f });
+	return {};
 }
 
-void ImagePlane::update(const vkl::Device& device, const vkl::SwapChain& swapChain, vkl::BufferManager& bufferManager)
+void TileData::benchmark(size_t tiles, std::ostream& os)
 {
-	if (!_imageData.data && _imageFuture.valid())
+	//shaped like the catalog: a handful of languages and ratings, every artwork URL the same bar its hash
+	static constexpr const char* languages[] = { "en", "es", "fr", "de", "it", "pt-BR", "ja", "ko" };
+	static constexpr const char* ratings[] = { "G", "PG", "PG-13", "TV-Y", "TV-Y7", "TV-G", "TV-PG", "TV-14" };
+	static constexpr const char* words[] = { "The", "Return", "of", "Legend", "Adventures", "Star", "Kingdom", "Secret", "Island", "Frozen" };
+	auto title = [&](size_t i) {
+		std::string text;
+		for (size_t word = 0; word < 2 + i % 4; ++word)
+		{
+			if (!text.empty())
+				text += ' ';
+			text += words[(i / (word + 1) + word) % std::size(words)];
+		}
+		return text + " " + std::to_string(i);
+	};
+	auto url = [](size_t i) {
+		char hash[65];
+		for (int part = 0; part < 4; ++part)
+			std::snprintf(hash + part * 16, 17, "%016llx", (unsigned long long)((i + 1) * 0x9E3779B97F4A7C15ull * (part + 1)));
+		return std::string("https://prod-ripcut-delivery.disney-plus.net/v1/variant/disney/") + hash + "/scale?format=jpeg&quality=90&scalingAlgorithm=lanczos3&width=500";
+	};
+
+	auto& strings = TileStrings::instance();
+	size_t arenaBefore = strings.arenaBytes();
+	size_t indexBefore = strings.indexBytes();
+	size_t rssBefore = residentBytes();
+	std::vector<TileData> compact(tiles);
+	for (size_t i = 0; i < tiles; ++i)
+	{
+		auto& data = compact[i];
+		data.setTitle(title(i));
+		data.setImageURL(url(i));
+		data.setLanguage(languages[i % std::size(languages)]);
+		data.setRating(ratings[i % std::size(ratings)]);
+		data.setContentId("content-" + std::to_string(i));
+		data.setType((Type)(i % 3));
+	}
+	size_t compactRss = residentBytes() - rssBefore;
+	size_t arena = strings.arenaBytes() - arenaBefore;
+	size_t index = strings.indexBytes() - indexBefore;
+
+	//what TileData used to be, heap bytes counted as each string's allocation past the small string buffer
+	struct Strings
 	{
-		bool ready = _imageFuture.wait_for(std::chrono::milliseconds(0)) == std::future_status::ready;
-		if (ready)
+		std::string title;
+		std::string imageURL;
+		std::string language;
+		std::string rating;
+		std::string type;
+	};
+	rssBefore = residentBytes();
+	std::vector<Strings> wide(tiles);
+	size_t heap = 0;
+	for (size_t i = 0; i < tiles; ++i)
+	{
+		auto& data = wide[i];
+		data = { title(i), url(i), languages[i % std::size(languages)], ratings[i % std::size(ratings)], std::string(compact[i].typeName()) };
+		for (auto* text : { &data.title, &data.imageURL, &data.language, &data.rating, &data.type })
 		{
-			_imageData = _imageFuture.get();
-			_imageFuture = {};
-			if (!_imageData.data)
-				return;
-
-			init(device, swapChain, bufferManager);
-			vkl::TextureOptions opt;
-			auto texBuff = bufferManager.createTextureBuffer(device, swapChain, _imageData.data, (size_t)_imageData.width, (size_t)_imageData.height, 4, opt);
-			addTexture(texBuff, 1);
+			if (text->capacity() > std::string().capacity())
+				heap += text->capacity() + 1;
 		}
 	}
+	size_t wideRss = residentBytes() - rssBefore;
+
+	auto perTile = [tiles](size_t bytes) { return (double)bytes / (double)tiles; };
+	os << "Tile data benchmark: " << tiles << " synthetic tiles" << std::endl;
+	os << "Tile data compact: " << perTile(sizeof(TileData) * tiles + arena + index) << " B/tile (" << sizeof(TileData) << " B object, " << perTile(arena) << " B arena, "
+		<< perTile(index) << " B index), " << perTile(compactRss) << " B/tile resident growth" << std::endl;
+	os << "Tile data as strings: " << perTile(sizeof(Strings) * tiles + heap) << " B/tile (" << sizeof(Strings) << " B object, " << perTile(heap) << " B heap before allocator overhead), "
+		<< perTile(wideRss) << " B/tile resident growth" << std::endl;
+	strings.report(os);
 }
 
-ImagePlane::~ImagePlane()
+ImagePlane::ImagePlane(TileBatch& batch) : _batch(batch)
 {
-	if (_imageData.data)
-		vxt::freeJPGData(_imageData.data);
 }
 
-void ImagePlane::setScreenPosition(float x, float y)
+ImagePlane::~ImagePlane()
 {
-	x += TileData::tile_width / 2.f;
-	y += TileData::tile_height / 2.f;
-	_transform = glm::translate(glm::identity<glm::mat4>(), { x ,y ,0 });
-	auto finalTransform = _transform;
-	if (_selected)
-	{
-		finalTransform = glm::scale(finalTransform, { 1.2, 1.2, 1.2 });
-	}
-	_uniform->setData({ finalTransform, _selected ? 1.f : 0.f });
+	_batch.erase(_quad);
+	_batch.free(_cell);
 }
 
-void ImagePlane::init(const vkl::Device& device, const vkl::SwapChain& swapChain, vkl::BufferManager& bufferManager)
+void ImagePlane::setImage(const std::string& url, FetchPriority priority)
 {
-	reset();
-	_verts.clear();
-	_indices.clear();
+	assert(!_image);
+	_imageRequested = true;
+	_image = ImageCache::instance().find(url);
+	if (_image)
+		return;
 
-	auto vbo = bufferManager.createVertexBuffer(device, swapChain);
+	_imageFetch = ImageCache::instance().request(url, priority);
+}
 
-	auto width = TileData::tile_width / 2.f;
-	auto height = TileData::tile_height / 2.f;
+void ImagePlane::setPriority(FetchPriority priority, int distance)
+{
+	_imageFetch.setPriority(priority, distance);
+}
 
-	_verts.push_back({ glm::vec2(-width, -height) , glm::vec2(0,0) });  //TL
-	_verts.push_back({ glm::vec2(width, -height) , glm::vec2(1,0) });  //TR
-	_verts.push_back({ glm::vec2(width, height) , glm::vec2(1,1) });  //BR
-	_verts.push_back({ glm::vec2(-width, height) , glm::vec2(0,1) });  //BL
+void ImagePlane::releaseImage()
+{
+	_imageFetch.cancel();
+	_image = nullptr;
+	_imageRequested = false;
+	_released = true;
+	_placementFailed = false;
+	_loadFailed = false;
+	bool placed = _cell.page != nullptr;
+	_batch.free(_cell);
+	//back to the blank page
+	if (placed && _quad.page)
+		writeQuad();
+}
 
-	vbo->setData(_verts.data(), sizeof(Vertex), _verts.size());
-	addVBO(vbo, 0);
+size_t ImagePlane::textureBytes() const
+{
+	//BC1 is expanded for the upload, so every texture is RGBA on the GPU
+	if (!_image || !_cell.page)
+		return 0;
+	return (size_t)_image->textureWidth * _image->textureHeight * 4;
+}
 
-	auto drawCall = std::make_shared<vkl::DrawCall>();
+void ImagePlane::setSelected(bool selected)
+{
+	if (selected == _selected)
+		return;
+	_selected = selected;
+	if (_quad.page)
+		writeQuad();
+}
 
-	//CCW wind
-	_indices.push_back(3);
-	_indices.push_back(1);
-	_indices.push_back(0);
+void ImagePlane::update()
+{
+	if (!_image && _imageFetch.ready())
+	{
+		_image = _imageFetch.get();
+		_loadFailed = !_image;
+	}
 
-	_indices.push_back(3);
-	_indices.push_back(2);
-	_indices.push_back(1);
+	if (_image && !_cell.page && !_placementFailed)
+	{
+		_placementFailed = !_batch.place(*_image, _cell);
+		if (_quad.page)
+			writeQuad();
+	}
+}
 
-	auto indexBuffer = bufferManager.createIndexBuffer(device, swapChain);
-	indexBuffer->setData(_indices);
-	drawCall->setCount(_indices.size());
+void ImagePlane::setScreenPosition(float x, float y)
+{
+	glm::vec2 centre{ x + TileData::tile_width / 2.f, y + TileData::tile_height / 2.f };
+	if (centre == _centre && _quad.page)
+		return;
+	_centre = centre;
+	writeQuad();
+}
 
-	drawCall->setIndexBuffer(indexBuffer);
+void ImagePlane::writeQuad()
+{
+	_batch.draw(_quad, _centre, _selected, _cell);
+}
 
-	addDrawCall(drawCall);
+bool Tile::update(TileBatch& batch, FetchPriority priority, int distance)
+{
+	bool acquired = !_imagePlane;
+	if (acquired)
+		_imagePlane = std::make_shared<ImagePlane>(batch);
 
-	_uniform = bufferManager.createTypedUniform<UniformData>(device, swapChain);
-	_uniform->setData({ _transform, _selected ? 1.f : 0.f });
-	addUniform(_uniform, 0);
+	_imagePlane->setPriority(priority, distance);
+	_imagePlane->update();
+	return acquired;
 }
 
-void Tile::update(const vkl::Device& device, const vkl::SwapChain& swapChain, const vkl::PipelineManager& pipelines, vkl::BufferManager& bufferManager, const glm::vec2& position, std::vector<std::shared_ptr<vkl::RenderObject>>& renderObjects)
+bool Tile::requestImage(FetchPriority priority, int distance)
 {
-	if (!_imagePlane)
-	{
-		_imagePlane = std::make_shared<ImagePlane>(device, swapChain, pipelines, bufferManager);
-		_imagePlane->setImage(_data.imageURL);
-		renderObjects.push_back(_imagePlane);
-	}
-
-	if (_imagePlane)
-	{
-		_imagePlane->setScreenPosition(position.x, position.y);
-		_imagePlane->update(device, swapChain, bufferManager);
-	}
+	//placeholder tiles have no image and keep the default texture
+	auto url = _data.imageURL();
+	if (!_imagePlane || url.empty())
+		return false;
+	_imagePlane->setImage(url, priority);
+	_imagePlane->setPriority(priority, distance);
+	return true;
 }
@@ -1,10 +1,11 @@
 #pragma once
+#include <ostream>
 #include <string>
-#include <vkl/RenderObject.h>
+#include <string_view>
 #include <vxt/LinearAlgebra.h>
-#include <vkl/PipelineFactory.h>
-#include <future>
-#include <vkl/UniformBuffer.h>
+#include "FetchScheduler.h"
+#include "ImageCache.h"
+#include "TileBatch.h"
 
 struct TileData
 {
@@ -13,63 +14,104 @@ struct TileData
 	static constexpr inline float tile_width = /*tile_height * tile_aspect_ratio*/tile_height; //NDC will make a square into the aspect ratio - really this should be pixels in the correct AR of the image in case of resized windows
 	static constexpr inline float tile_gap_vertical = tile_height / 4.f;
 	static constexpr inline float tile_gap_horizontal = tile_width / 8.f;
+	static constexpr inline float selected_scale = 1.2f;
 
 	static constexpr inline int visible_tiles = (int)(2.f / (tile_height+(tile_gap_vertical*2)) + 1);
 	static constexpr inline int visible_tiles_horizontal = (int)(2.f / (tile_width + (tile_gap_horizontal * 2)) + 1);
 
-	std::string title;
-	std::string imageURL;
-	std::string language;
-	std::string rating;
-	std::string type;
-};
-
-class ImagePlane : public vkl::RenderObject
-{
-	PIPELINE_TYPE
-	static void describePipeline(vkl::PipelineDescription& description);
-
-	struct Vertex
+	enum class Type : uint8_t
 	{
-		glm::vec2 pos;
-		glm::vec2 uv;
+		Series,
+		Movie,
+		Collection
 	};
 
-public:
-	struct ImageData
-	{
-		void* data = nullptr;
-		uint32_t width, height;
-	};
-	struct UniformData
-	{
-		glm::mat4 transform;
-		float selected = 0.f;
-	};
+	std::string_view title() const { return { _title, _titleLength }; }
+	void setTitle(std::string_view title);
 
-	ImagePlane() = delete;
-	ImagePlane(const vkl::Device& device, const vkl::SwapChain& swapChain, const vkl::PipelineManager& pipelines, vkl::BufferManager& bufferManager);
+	//Stored as an interned head and tail around the unique part (the longest path segment, usually the content hash)
+	std::string imageURL() const;
+	void setImageURL(std::string_view url);
 
-	void setImage(const std::string& path);
-	void setSelected(bool selected);
+	std::string_view language() const;
+	void setLanguage(std::string_view language);
 
-	void update(const vkl::Device& device, const vkl::SwapChain& swapChain, vkl::BufferManager& bufferManager);
+	std::string_view rating() const;
+	void setRating(std::string_view rating);
 
+	//Identity of the title across catalog refreshes, a hash of its content id
+	uint64_t contentKey() const { return _contentKey; }
+	void setContentId(std::string_view contentId);
+
+	Type type() const { return _type; }
+	std::string_view typeName() const;
+	void setType(Type type) { _type = type; }
+
+	//Stores synthetic catalog tiles both this way and as the five std::strings a tile used to
+	//hold, reporting bytes per tile for each
+	static void benchmark(size_t tiles, std::ostream& os);
+
+private:
+	friend class GridSnapshot;
+
+	uint64_t _contentKey = 0;
+	const char* _title = nullptr;
+	const char* _imageId = nullptr;
+	uint32_t _titleLength = 0;
+	uint32_t _imageIdLength = 0;
+	uint32_t _imageHead = 0;
+	uint32_t _imageTail = 0;
+	uint16_t _language = 0;
+	uint16_t _rating = 0;
+	Type _type = Type::Series;
+};
+
+//A tile's artwork and how it is drawn.  Planes are not render objects themselves, TileBatch
+//draws every live one together, a page of them per draw.
+class ImagePlane
+{
+public:
+	ImagePlane() = delete;
+	explicit ImagePlane(TileBatch& batch);
 	~ImagePlane();
+	ImagePlane(const ImagePlane&) = delete;
+	ImagePlane& operator=(const ImagePlane&) = delete;
 
+	void setImage(const std::string& path, FetchPriority priority);
+	void setPriority(FetchPriority priority, int distance);
+	void setSelected(bool selected);
+	bool hasImage() const { return _image != nullptr; }
+
+	//Loaded, loading or failed: set from setImage until the image is released
+	bool imageRequested() const { return _imageRequested; }
+	//The load came back empty or the texture is too big to upload, it is not tried again until released
+	bool loadFailed() const { return _loadFailed || _placementFailed; }
+	//Frees the texture's cell and drops the decoded image, the cache may then evict the image too
+	void releaseImage();
+	bool wasReleased() const { return _released; }
+	//GPU memory of the texture, 0 until it is placed
+	size_t textureBytes() const;
+
+	//Places newly arrived artwork in the batch
+	void update();
+
+	//Moves the plane's quad, only when the position differs from the one it has
 	void setScreenPosition(float x, float y);
 
 private:
+	void writeQuad();
 
-	void init(const vkl::Device& device, const vkl::SwapChain& swapChain, vkl::BufferManager& bufferManager);
-
-	glm::mat4 _transform;
+	TileBatch& _batch;
+	TileBatch::Cell _cell;
+	TileBatch::Quad _quad;
+	glm::vec2 _centre{ 0.f, 0.f };
 	bool _selected = false;
-	std::vector<Vertex> _verts;
-	std::vector<uint32_t> _indices;
-	ImageData _imageData;
-	std::future<ImageData> _imageFuture;
-	std::shared_ptr<vkl::TypedUniform<UniformData>> _uniform;
+	ImageCache::Image _image;
+	bool _placementFailed = false;
+	bool _loadFailed = false;
+	bool _imageRequested = false;
+	bool _released = false;
+	PendingFetch<ImageCache::Image> _imageFetch;
 };
 
 
@@ -80,11 +122,14 @@ public:
 	TileData& data() { return _data; }
 	const TileData& data() const { return _data; }
 
-	void update(const vkl::Device& device, const vkl::SwapChain& swapChain, const vkl::PipelineManager& pipelines, vkl::BufferManager& bufferManager, const glm::vec2& position, std::vector<std::shared_ptr<vkl::RenderObject>>& renderObjects);
+	//The position comes from TileLayout once the whole window is laid out.  True when the plane
+	//was acquired just now.
+	bool update(TileBatch& batch, FetchPriority priority, int distance);
+	//Starts loading the artwork, false for tiles without any
+	bool requestImage(FetchPriority priority, int distance);
 	std::shared_ptr< ImagePlane> _imagePlane;
 
 private:
-	std::vector<glm::vec2> _verts;
 	TileData _data;
 };
 
@@ -0,0 +1,481 @@
+#include "TileBatch.h"
+#include "Tile.h"
+#include "BlockCompression.h"
+
+#include <algorithm>
+#include <unordered_set>
+
+namespace
+{
+	constexpr const char* VertShader = R"Shader(
+
+#version 450
+
+layout(location = 0) in vec2 inCorner;
+layout(location = 1) in vec2 inUV;
+layout(location = 2) in vec4 inPlacement;
+layout(location = 3) in vec4 inCell;
+layout(location = 4) in vec4 inMip;
+
+layout(location = 0) out vec2 fragUV;
+layout(location = 1) flat out vec4 fragCell;
+layout(location = 2) flat out vec4 fragMip;
+
+void main() {
+	gl_Position = vec4(inPlacement.xy + inCorner * inPlacement.zw, 0.0, 1.0);
+	fragUV = inUV;
+	fragCell = inCell;
+	fragMip = inMip;
+}
+)Shader";
+	constexpr const char* FragShader = R"Shader(
+
+#version 450
+
+//one per cell of the page, vkl has no texture arrays
+layout(binding = 0) uniform sampler2D tex0;
+layout(binding = 1) uniform sampler2D tex1;
+layout(binding = 2) uniform sampler2D tex2;
+layout(binding = 3) uniform sampler2D tex3;
+layout(binding = 4) uniform sampler2D tex4;
+layout(binding = 5) uniform sampler2D tex5;
+layout(binding = 6) uniform sampler2D tex6;
+layout(binding = 7) uniform sampler2D tex7;
+
+layout(location = 0) in vec2 fragUV;
+layout(location = 1) flat in vec4 fragCell;
+layout(location = 2) flat in vec4 fragMip;
+
+layout(location = 0) out vec4 outColor;
+
+vec4 fetch(vec2 texel)
+{
+	switch (int(fragCell.x))
+	{
+	case 1: return textureLod(tex1, texel / vec2(textureSize(tex1, 0)), 0.0);
+	case 2: return textureLod(tex2, texel / vec2(textureSize(tex2, 0)), 0.0);
+	case 3: return textureLod(tex3, texel / vec2(textureSize(tex3, 0)), 0.0);
+	case 4: return textureLod(tex4, texel / vec2(textureSize(tex4, 0)), 0.0);
+	case 5: return textureLod(tex5, texel / vec2(textureSize(tex5, 0)), 0.0);
+	case 6: return textureLod(tex6, texel / vec2(textureSize(tex6, 0)), 0.0);
+	case 7: return textureLod(tex7, texel / vec2(textureSize(tex7, 0)), 0.0);
+	default: return textureLod(tex0, texel / vec2(textureSize(tex0, 0)), 0.0);
+	}
+}
+
+//fragCell.zw is level 0's size, the smaller levels sit in a column right of level 0
+vec4 sampleLevel(vec2 uv, int level)
+{
+	vec2 size = fragCell.zw;
+	vec2 origin = vec2(0.0);
+	for (int i = 1; i <= level; ++i)
+	{
+		if (i > 1)
+			origin.y += size.y;
+		origin.x = fragCell.z;
+		size = max(floor(size / 2.0), vec2(1.0));
+	}
+	//clamped half a texel inside the level so the filter never reaches a neighbour
+	vec2 texel = clamp(uv * size, vec2(0.5), size - 0.5);
+	return fetch(origin + texel);
+}
+
+void main() {
+
+	if (fragMip.z == 0.0)
+	{
+		outColor = vec4(1.0);
+	}
+	else if (fragMip.x > 1.0)
+	{
+		vec2 texels = fragUV * fragCell.zw;
+		float footprint = max(length(dFdx(texels)), length(dFdy(texels)));
+		float lod = clamp(log2(max(footprint, 1e-6)), 0.0, fragMip.x - 1.0);
+		int level = int(lod);
+		outColor = mix(sampleLevel(fragUV, level), sampleLevel(fragUV, min(level + 1, int(fragMip.x) - 1)), fract(lod));
+	}
+	else
+	{
+		outColor = sampleLevel(fragUV, 0);
+	}
+
+	if(fragMip.y > 0.f)
+	{
+		if(fragUV.x < .01 || fragUV.x >.99 || fragUV.y < .01 || fragUV.y > .99)
+			outColor = vec4(1,1,1,1);
+		else if(fragUV.x < .02 || fragUV.x >.98 || fragUV.y < .02 || fragUV.y > .98)
+			outColor = vec4(0,0,0,1);
+	}
+
+	//the selected tile is scaled up over its neighbours
+	gl_FragDepth = fragMip.y > 0.f ? .4f : .5f;
+}
+)Shader";
+
+	static const unsigned char whitePixel[4] = { 255, 255,255, 255 };
+}
+
+REGISTER_PIPELINE(TilePage, TilePage::describePipeline)
+
+void TilePage::describePipeline(vkl::PipelineDescription& description)
+{
+	description.setPrimitiveTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+
+	description.addShaderGLSL(VK_SHADER_STAGE_VERTEX_BIT, VertShader);
+	description.addShaderGLSL(VK_SHADER_STAGE_FRAGMENT_BIT, FragShader);
+
+	description.declareVertexAttribute(0, 0, VK_FORMAT_R32G32_SFLOAT, sizeof(Vertex), offsetof(Vertex, corner));
+	description.declareVertexAttribute(0, 1, VK_FORMAT_R32G32_SFLOAT, sizeof(Vertex), offsetof(Vertex, uv));
+	description.declareVertexAttribute(0, 2, VK_FORMAT_R32G32B32A32_SFLOAT, sizeof(Vertex), offsetof(Vertex, placement));
+	description.declareVertexAttribute(0, 3, VK_FORMAT_R32G32B32A32_SFLOAT, sizeof(Vertex), offsetof(Vertex, cell));
+	description.declareVertexAttribute(0, 4, VK_FORMAT_R32G32B32A32_SFLOAT, sizeof(Vertex), offsetof(Vertex, mip));
+
+	for (uint32_t binding = 0; binding < cells_per_page; ++binding)
+		description.declareTexture(binding);
+}
+
+TilePage::TilePage(bool blank)
+{
+	if (blank)
+		return;
+	_used.resize(cells_per_page, false);
+	_uploaded.resize(cells_per_page, false);
+	_pending.resize(cells_per_page, nullptr);
+	_textures.resize(cells_per_page);
+	_cellTextures.resize(cells_per_page);
+	_cellLevels.resize(cells_per_page, 1.f);
+	_cellBytes.resize(cells_per_page, 0);
+	_waiting.resize(cells_per_page, nullptr);
+	_vertices.resize(cells_per_page * 4, Vertex{});
+	_liveSlots.resize(cells_per_page, false);
+}
+
+uint32_t TilePage::allocate(const DecodedImage& image)
+{
+	auto index = (uint32_t)(std::find(_used.begin(), _used.end(), false) - _used.begin());
+	_used[index] = true;
+	_usedCells++;
+	_uploaded[index] = false;
+	_pending[index] = &image;
+	_cellTextures[index] = { (float)index, 0.f, (float)image.width, (float)image.height };
+	_cellLevels[index] = (float)image.levels;
+	_cellBytes[index] = (size_t)image.textureWidth * image.textureHeight * 4;
+	_textureBytes += _cellBytes[index];
+	return index;
+}
+
+void TilePage::free(uint32_t index)
+{
+	_textureBytes -= _cellBytes[index];
+	_cellBytes[index] = 0;
+	_used[index] = false;
+	_usedCells--;
+	_uploaded[index] = false;
+	_pending[index] = nullptr;
+	_waiting[index] = nullptr;
+	//the texture goes once the page is bound without it
+	if (_textures[index])
+	{
+		_textures[index] = nullptr;
+		_texturesChanged = true;
+	}
+}
+
+uint32_t TilePage::allocateSlot()
+{
+	if (!_freeSlots.empty())
+	{
+		auto slot = _freeSlots.back();
+		_freeSlots.pop_back();
+		return slot;
+	}
+	_vertices.resize(_vertices.size() + 4, Vertex{});
+	_liveSlots.push_back(false);
+	return (uint32_t)_liveSlots.size() - 1;
+}
+
+void TilePage::write(uint32_t slot, const Vertex (&corners)[4])
+{
+	if (!_liveSlots[slot])
+	{
+		_liveSlots[slot] = true;
+		_quads++;
+	}
+	std::copy(corners, corners + 4, _vertices.begin() + (size_t)slot * 4);
+	_verticesDirty = true;
+}
+
+void TilePage::clear(uint32_t slot)
+{
+	if (!_liveSlots[slot])
+		return;
+	_liveSlots[slot] = false;
+	_quads--;
+	//zero sized, drawn but covers nothing
+	std::fill(_vertices.begin() + (size_t)slot * 4, _vertices.begin() + (size_t)slot * 4 + 4, Vertex{});
+	_verticesDirty = true;
+	if (blank())
+		_freeSlots.push_back(slot);
+}
+
+bool TilePage::uploadTextures(const vkl::Device& device, const vkl::SwapChain& swapChain, vkl::BufferManager& bufferManager, TileBatch& batch)
+{
+	if (!_vbo)
+	{
+		_vbo = bufferManager.createVertexBuffer(device, swapChain);
+		_indexBuffer = bufferManager.createIndexBuffer(device, swapChain);
+		_drawCall = std::make_shared<vkl::DrawCall>();
+		_drawCall->setIndexBuffer(_indexBuffer);
+		countBufferAllocations(2);
+	}
+
+	bool uploaded = false;
+	for (uint32_t i = 0; i < _pending.size(); ++i)
+	{
+		const auto* image = _pending[i];
+		if (!image)
+			continue;
+		_pending[i] = nullptr;
+
+		const unsigned char* pixels = image->pixels.get();
+		if (image->compression == TextureCompression::BC1)
+		{
+			batch._expanded.resize((size_t)image->textureWidth * image->textureHeight * 4);
+			decodeBC1(pixels, image->textureWidth, image->textureHeight, batch._expanded.data());
+			pixels = batch._expanded.data();
+		}
+		_textures[i] = bufferManager.createTextureBuffer(device, swapChain, pixels, (size_t)image->textureWidth, (size_t)image->textureHeight, 4);
+		countBufferAllocations(1);
+		countUploads(1);
+		batch._textureUploads++;
+		batch._textureUploadBytes += _cellBytes[i];
+		_uploaded[i] = true;
+		_texturesChanged = true;
+		uploaded = true;
+	}
+
+	if (_texturesChanged)
+	{
+		_texturesChanged = false;
+		bind(batch._blankTexture);
+		batch._binds++;
+	}
+	return uploaded;
+}
+
+void TilePage::uploadVertices(const vkl::Device& device, const vkl::SwapChain& swapChain, vkl::BufferManager& bufferManager, TileBatch& batch)
+{
+	if (!_verticesDirty)
+		return;
+	_verticesDirty = false;
+
+	//the index pattern only depends on the slot count, so it only grows
+	size_t slots = _liveSlots.size();
+	if (_indices.size() < slots * 6)
+	{
+		size_t begin = _indices.size() / 6;
+		for (size_t i = begin; i < slots; ++i)
+		{
+			//CCW wind, as the quads always were
+			uint32_t base = (uint32_t)(i * 4);
+			_indices.insert(_indices.end(), { base + 3, base + 1, base + 0, base + 3, base + 2, base + 1 });
+		}
+		_indexBuffer->setData(_indices);
+		countUploads(1);
+	}
+
+	if (!_vertices.empty())
+	{
+		_vbo->setData(_vertices.data(), sizeof(Vertex), _vertices.size());
+		countUploads(1);
+	}
+	_drawCall->setCount(_quads ? slots * 6 : 0);
+	batch._vertexUploads++;
+	batch._vertexUploadBytes += _vertices.size() * sizeof(Vertex);
+}
+
+void TilePage::bind(const TextureHandle& blankTexture)
+{
+	//textures cannot be swapped on their own, so the buffers are attached again around the new set.
+	//Every declared binding needs a texture, cells without one get the blank texture.
+	reset();
+	addVBO(_vbo, 0);
+	addDrawCall(_drawCall);
+	for (uint32_t binding = 0; binding < cells_per_page; ++binding)
+		addTexture(binding < _textures.size() && _textures[binding] ? _textures[binding] : blankTexture, binding);
+}
+
+TileBatch::TileBatch()
+{
+	_pages.push_back(std::make_shared<TilePage>(true));
+}
+
+bool TileBatch::place(const DecodedImage& image, Cell& cell)
+{
+	if (image.textureWidth > max_texture_size || image.textureHeight > max_texture_size)
+	{
+		_oversized++;
+		return false;
+	}
+
+	auto itr = std::find_if(_pages.begin() + 1, _pages.end(), [](const std::shared_ptr<TilePage>& page) { return !page->full(); });
+	if (itr == _pages.end())
+	{
+		_pages.push_back(std::make_shared<TilePage>(false));
+		itr = _pages.end() - 1;
+		_peakPages = std::max(_peakPages, _pages.size() - 1);
+	}
+
+	cell.page = itr->get();
+	cell.index = (*itr)->allocate(image);
+	return true;
+}
+
+size_t TileBatch::residentBytes() const
+{
+	size_t bytes = 0;
+	for (auto itr = _pages.begin() + 1; itr != _pages.end(); ++itr)
+		bytes += (*itr)->textureBytes();
+	return bytes;
+}
+
+void TileBatch::free(Cell& cell)
+{
+	if (!cell.page)
+		return;
+	cell.page->free(cell.index);
+	cell = {};
+}
+
+void TileBatch::corners(const glm::vec4& placement, bool selected, const TilePage* page, uint32_t index, TilePage::Vertex (&vertices)[4])
+{
+	glm::vec4 texture{ 0.f, 0.f, 0.f, 0.f };
+	glm::vec4 mip{ 1.f, selected ? 1.f : 0.f, 0.f, 0.f };
+	if (page && !page->blank())
+	{
+		texture = page->_cellTextures[index];
+		mip.x = page->_cellLevels[index];
+		mip.z = 1.f;
+	}
+
+	vertices[0] = { glm::vec2(-1.f, -1.f), glm::vec2(0,0), placement, texture, mip };  //TL
+	vertices[1] = { glm::vec2(1.f, -1.f), glm::vec2(1,0), placement, texture, mip };  //TR
+	vertices[2] = { glm::vec2(1.f, 1.f), glm::vec2(1,1), placement, texture, mip };  //BR
+	vertices[3] = { glm::vec2(-1.f, 1.f), glm::vec2(0,1), placement, texture, mip };  //BL
+}
+
+void TileBatch::draw(Quad& quad, const glm::vec2& centre, bool selected, const Cell& cell)
+{
+	bool ready = cell.page && cell.page->uploaded(cell.index);
+	TilePage* page = ready ? cell.page : _pages.front().get();
+	if (cell.page && !ready)
+		cell.page->_waiting[cell.index] = &quad;
+	if (quad.page && (quad.page != page || (!page->blank() && quad.index != cell.index)))
+		erase(quad);
+	if (!quad.page)
+	{
+		quad.page = page;
+		quad.index = page->blank() ? page->allocateSlot() : cell.index;
+	}
+
+	float scale = selected ? TileData::selected_scale : 1.f;
+	glm::vec4 placement{ centre.x, centre.y, TileData::tile_width / 2.f * scale, TileData::tile_height / 2.f * scale };
+	TilePage::Vertex vertices[4];
+	corners(placement, selected, page, quad.index, vertices);
+	page->write(quad.index, vertices);
+	_quadWrites++;
+}
+
+void TileBatch::promote(TilePage& page, uint32_t index)
+{
+	auto* quad = page._waiting[index];
+	page._waiting[index] = nullptr;
+	if (!quad || !quad->page || !quad->page->blank())
+		return;
+
+	//the blank quad already has the tile's placement and selection
+	const auto& drawn = quad->page->_vertices[(size_t)quad->index * 4];
+	TilePage::Vertex vertices[4];
+	corners(drawn.placement, drawn.mip.y > 0.f, &page, index, vertices);
+	erase(*quad);
+	page.write(index, vertices);
+	*quad = { &page, index };
+	_quadWrites++;
+}
+
+void TileBatch::erase(Quad& quad)
+{
+	if (!quad.page)
+		return;
+	quad.page->clear(quad.index);
+	quad = {};
+}
+
+void TileBatch::submit(const vkl::Device& device, const vkl::SwapChain& swapChain, vkl::BufferManager& bufferManager, std::vector<std::shared_ptr<vkl::RenderObject>>& renderObjects)
+{
+	auto begin = std::chrono::steady_clock::now();
+
+	if (!_blankTexture)
+	{
+		_blankTexture = bufferManager.createTextureBuffer(device, swapChain, whitePixel, 1, 1, 4);
+		countBufferAllocations(1);
+		countUploads(1);
+	}
+
+	//empty pages go, bar one kept for the next textures to arrive
+	std::unordered_set<const vkl::RenderObject*> dropped;
+	bool spare = false;
+	for (auto itr = _pages.begin() + 1; itr != _pages.end();)
+	{
+		if ((*itr)->empty() && spare)
+		{
+			if ((*itr)->_listed)
+				dropped.insert(itr->get());
+			itr = _pages.erase(itr);
+			continue;
+		}
+		spare = spare || (*itr)->empty();
+		++itr;
+	}
+	if (!dropped.empty())
+		renderObjects.erase(std::remove_if(renderObjects.begin(), renderObjects.end(), [&dropped](const std::shared_ptr<vkl::RenderObject>& ro) { return dropped.count(ro.get()) > 0; }), renderObjects.end());
+
+	//textures first, the quads waiting on them move off the blank page before any vertices go up
+	for (auto&& page : _pages)
+	{
+		if (!page->uploadTextures(device, swapChain, bufferManager, *this))
+			continue;
+		for (uint32_t i = 0; i < page->_waiting.size(); ++i)
+		{
+			if (page->_waiting[i] && page->_uploaded[i])
+				promote(*page, i);
+		}
+	}
+
+	_drawCalls = 0;
+	_quads = 0;
+	for (auto&& page : _pages)
+	{
+		if (page->quads())
+			_drawCalls++;
+		_quads += page->quads();
+		page->uploadVertices(device, swapChain, bufferManager, *this);
+		if (!page->_listed)
+		{
+			page->_listed = true;
+			renderObjects.push_back(page);
+		}
+	}
+	_peakDrawCalls = std::max(_peakDrawCalls, _drawCalls);
+	_submitTime.record(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count());
+}
+
+void TileBatch::report(std::ostream& os) const
+{
+	os << "Tile batch: " << _quads << " tiles in " << _drawCalls << " draw calls (one per page of up to " << TilePage::cells_per_page << " textures), peak "
+		<< _peakDrawCalls << ", " << _pages.size() - 1 << " pages, peak " << _peakPages << ", " << _oversized << " textures too big to upload" << std::endl;
+	os << "Tile textures: " << _textureUploads << " uploads of " << _textureUploadBytes << " bytes, one per texture at its own size, "
+		<< residentBytes() << " bytes resident, " << _binds << " page binds" << std::endl;
+	os << "Tile quads: " << _quadWrites << " quad writes, " << _vertexUploads << " vertex uploads of " << _vertexUploadBytes << " bytes" << std::endl;
+	_submitTime.report(os, "Tile batch submission");
+}
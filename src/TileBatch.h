@@ -0,0 +1,179 @@
+#pragma once
+#include <chrono>
+#include <memory>
+#include <ostream>
+#include <utility>
+#include <vector>
+#include <vkl/RenderObject.h>
+#include <vxt/LinearAlgebra.h>
+#include <vkl/PipelineFactory.h>
+#include <vkl/VertexBuffer.h>
+#include <vkl/IndexBuffer.h>
+#include <vkl/DrawCall.h>
+#include <vkl/BufferManager.h>
+#include "Stats.h"
+
+struct DecodedImage;
+class TileBatch;
+class TilePage;
+
+//A cell or quad slot in a page, page is null while there is none
+struct TileCell
+{
+	TilePage* page = nullptr;
+	uint32_t index = 0;
+};
+
+//One draw of up to cells_per_page tiles, each sampling its own texture through one of the
+//page's texture bindings.  The page with no cells draws the tiles that have no texture yet.
+//Every tile keeps a fixed slot of four vertices in its page's vertex buffer, the cell's index on
+//a textured page, so a tile that moves rewrites its own slot and nothing else.
+class TilePage : public vkl::RenderObject
+{
+	PIPELINE_TYPE
+	static void describePipeline(vkl::PipelineDescription& description);
+
+public:
+	//vkl has no instance rate attributes, so every corner of a tile's quad carries the tile's
+	//instance data along with the shared quad's corner and uv
+	struct Vertex
+	{
+		glm::vec2 corner;
+		glm::vec2 uv;
+		//centre and half size in NDC, selection scale included
+		glm::vec4 placement;
+		//the texture's binding, unused, and its level 0 size in texels
+		glm::vec4 cell;
+		//level count, selected, textured
+		glm::vec4 mip;
+	};
+
+	//vkl has no texture arrays, so a page declares this many separate texture bindings and the
+	//shader picks one per tile.  Well inside the 16 samplers per stage every Vulkan device has.
+	static constexpr inline uint32_t cells_per_page = 8;
+
+	explicit TilePage(bool blank);
+
+	bool blank() const { return _used.empty(); }
+	bool full() const { return _usedCells == _used.size(); }
+	bool empty() const { return _usedCells == 0; }
+
+	//The image must outlive the cell, its texels are read when the texture is uploaded
+	uint32_t allocate(const DecodedImage& image);
+	void free(uint32_t index);
+	//The cell's texture is on the GPU, until then its tile draws blank
+	bool uploaded(uint32_t index) const { return _uploaded[index]; }
+	size_t cells() const { return _used.size(); }
+	size_t freeCells() const { return _used.size() - _usedCells; }
+	//Bytes of the textures in the used cells, all RGBA
+	size_t textureBytes() const { return _textureBytes; }
+
+	//Slots of the blank page come and go with the tiles, a textured page has one per cell
+	uint32_t allocateSlot();
+	void write(uint32_t slot, const Vertex (&corners)[4]);
+	//Collapses the slot's quad, the blank page takes the slot back
+	void clear(uint32_t slot);
+	size_t quads() const { return _quads; }
+
+	//Creates the textures of newly placed cells, each at its own size, and binds the page again
+	//if its textures changed.  True when a texture was uploaded.
+	bool uploadTextures(const vkl::Device& device, const vkl::SwapChain& swapChain, vkl::BufferManager& bufferManager, TileBatch& batch);
+	//Uploads the vertices if a slot changed
+	void uploadVertices(const vkl::Device& device, const vkl::SwapChain& swapChain, vkl::BufferManager& bufferManager, TileBatch& batch);
+
+private:
+	//Whatever vkl's buffer manager hands out for a texture
+	using TextureHandle = decltype(std::declval<vkl::BufferManager&>().createTextureBuffer(std::declval<const vkl::Device&>(), std::declval<const vkl::SwapChain&>(), nullptr, 0, 0, 0));
+
+	friend class TileBatch;
+
+	void bind(const TextureHandle& blankTexture);
+
+	bool _listed = false;
+	std::vector<bool> _used;
+	size_t _usedCells = 0;
+	std::vector<bool> _uploaded;
+	//placed and not uploaded yet
+	std::vector<const DecodedImage*> _pending;
+	std::vector<TextureHandle> _textures;
+	std::vector<glm::vec4> _cellTextures;
+	std::vector<float> _cellLevels;
+	std::vector<size_t> _cellBytes;
+	size_t _textureBytes = 0;
+	bool _texturesChanged = true;
+	//the quad of a tile drawing blank until its cell is uploaded, moved here once it is
+	std::vector<TileCell*> _waiting;
+
+	std::vector<Vertex> _vertices;
+	std::vector<bool> _liveSlots;
+	std::vector<uint32_t> _freeSlots;
+	size_t _quads = 0;
+	bool _verticesDirty = true;
+	std::vector<uint32_t> _indices;
+	std::shared_ptr<vkl::VertexBuffer> _vbo;
+	std::shared_ptr<vkl::IndexBuffer> _indexBuffer;
+	std::shared_ptr<vkl::DrawCall> _drawCall;
+};
+
+//Draws every live tile out of a few shared pages, one draw call per page, instead of one render
+//object, uniform and draw per tile.  Each tile's texture is uploaded once, at its own size, and
+//only rebinding a page touches the others.  Tiles write their quad when they move or change,
+//pages only upload their vertices when a quad changed.
+class TileBatch
+{
+public:
+	TileBatch();
+
+	//The smallest maxImageDimension2D every Vulkan device supports
+	static constexpr inline uint32_t max_texture_size = 4096;
+
+	//Where a tile's texture lives, page is null until it is placed
+	using Cell = TileCell;
+	//Where a tile's quad lives, on its texture's page or the blank one, page is null while it has none
+	using Quad = TileCell;
+
+	//Takes a free cell for the texture, uploaded on the next submit.  The image must stay alive
+	//until the cell is freed.  False for textures bigger than max_texture_size, those tiles stay
+	//untextured.
+	bool place(const DecodedImage& image, Cell& cell);
+	void free(Cell& cell);
+
+	//Writes the tile's quad, on its texture's page once the cell is uploaded.  Drawn every frame until erased.
+	void draw(Quad& quad, const glm::vec2& centre, bool selected, const Cell& cell);
+	void erase(Quad& quad);
+
+	//GPU memory of the placed textures, a texture's bytes are freed with its cell
+	size_t residentBytes() const;
+
+	//Hands the frame's changes to the pages and keeps the page render objects in the list
+	void submit(const vkl::Device& device, const vkl::SwapChain& swapChain, vkl::BufferManager& bufferManager, std::vector<std::shared_ptr<vkl::RenderObject>>& renderObjects);
+
+	void report(std::ostream& os) const;
+
+private:
+	static void corners(const glm::vec4& placement, bool selected, const TilePage* page, uint32_t index, TilePage::Vertex (&vertices)[4]);
+	//Moves a waiting quad from the blank page onto its freshly uploaded cell
+	void promote(TilePage& page, uint32_t index);
+
+	//the blank page first
+	std::vector<std::shared_ptr<TilePage>> _pages;
+	//bound wherever a page has no texture, and the blank page's only texture
+	TilePage::TextureHandle _blankTexture;
+	//BC1 textures are expanded here for the upload, vkl has no compressed formats
+	std::vector<unsigned char> _expanded;
+
+	friend class TilePage;
+
+	size_t _drawCalls = 0;
+	size_t _peakDrawCalls = 0;
+	size_t _quads = 0;
+	size_t _peakPages = 0;
+	uint64_t _textureUploads = 0;
+	uint64_t _textureUploadBytes = 0;
+	uint64_t _binds = 0;
+	uint64_t _quadWrites = 0;
+	uint64_t _vertexUploads = 0;
+	uint64_t _vertexUploadBytes = 0;
+	uint64_t _oversized = 0;
+	LatencyStats _submitTime;
+};
@@ -0,0 +1,155 @@
+#include "TileLayout.h"
+#include "Tile.h"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+
+void TileLayout::begin()
+{
+	_rows.clear();
+	_columns.clear();
+	_selected.clear();
+	_acquired.clear();
+	_planes.clear();
+}
+
+void TileLayout::addRow(const glm::vec2& origin)
+{
+	auto end = (uint32_t)_columns.size();
+	_rows.push_back({ origin, end, end });
+}
+
+void TileLayout::add(ImagePlane* plane, int column, bool selected, bool acquired)
+{
+	_columns.push_back((float)column);
+	_selected.push_back(selected ? 1 : 0);
+	_acquired.push_back(acquired ? 1 : 0);
+	_planes.push_back(plane);
+	_rows.back().end++;
+}
+
+size_t TileLayout::run()
+{
+	auto begin = std::chrono::steady_clock::now();
+	layout();
+	_layoutTime.record(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count());
+
+	for (auto i : _changed)
+	{
+		_planes[i]->setSelected(_selected[i] != 0);
+		_planes[i]->setScreenPosition(_x[i], _y[i]);
+	}
+
+	_tiles = _planes.size();
+	_frames++;
+	_changedTotal += _changed.size();
+	_peakChanged = std::max(_peakChanged, _changed.size());
+
+	std::swap(_x, _previousX);
+	std::swap(_y, _previousY);
+	std::swap(_selected, _previousSelected);
+	std::swap(_planes, _previousPlanes);
+	return _changed.size();
+}
+
+void TileLayout::layout()
+{
+	size_t count = _planes.size();
+	_x.resize(count);
+	_y.resize(count);
+
+	//a row's tiles only differ by their column, so each run is a plain multiply add over the array
+	constexpr float stride = TileData::tile_width + TileData::tile_gap_horizontal;
+	float* x = _x.data();
+	float* y = _y.data();
+	const float* columns = _columns.data();
+	for (auto&& row : _rows)
+	{
+		for (uint32_t i = row.begin; i < row.end; ++i)
+		{
+			x[i] = row.origin.x + columns[i] * stride;
+			y[i] = row.origin.y;
+		}
+	}
+
+	//compared without branching so this vectorizes too; a plane acquired this frame has no quad
+	//yet, even at an address and position the last frame had
+	size_t kept = std::min(count, _previousPlanes.size());
+	_dirty.assign(count, 1);
+	uint8_t* dirty = _dirty.data();
+	for (size_t i = 0; i < kept; ++i)
+	{
+		dirty[i] = (uint8_t)((x[i] != _previousX[i]) | (y[i] != _previousY[i]) | (_selected[i] != _previousSelected[i]) |
+			(_planes[i] != _previousPlanes[i]) | (_acquired[i] != 0));
+	}
+
+	_changed.clear();
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		if (dirty[i])
+			_changed.push_back(i);
+	}
+}
+
+void TileLayout::report(std::ostream& os) const
+{
+	os << "Tile layout: " << _tiles << " tiles, " << (_frames ? (double)_changedTotal / (double)_frames : 0.0) << " changed per frame, peak " << _peakChanged << std::endl;
+	_layoutTime.report(os, "Tile layout pass");
+}
+
+void TileLayout::benchmark(size_t tiles, std::ostream& os)
+{
+	constexpr int columns = 32;
+	constexpr int frames = 50;
+	TileBatch batch;
+	std::vector<std::unique_ptr<ImagePlane>> planes;
+	planes.reserve(tiles);
+	for (size_t i = 0; i < tiles; ++i)
+		planes.push_back(std::make_unique<ImagePlane>(batch));
+
+	TileLayout layout;
+	auto fill = [&](float scroll) {
+		layout.begin();
+		for (size_t i = 0; i < tiles; ++i)
+		{
+			if (i % columns == 0)
+				layout.addRow({ -1.f + scroll, -1.f + (float)(i / columns) * (TileData::tile_height + TileData::tile_gap_vertical) });
+			layout.add(planes[i].get(), (int)(i % columns), i == 0, false);
+		}
+	};
+
+	//the first run gives every plane its quad, after that the pass alone is timed
+	layout.begin();
+	for (size_t i = 0; i < tiles; ++i)
+	{
+		if (i % columns == 0)
+			layout.addRow({ -1.f, 0.f });
+		layout.add(planes[i].get(), (int)(i % columns), false, true);
+	}
+	layout.run();
+
+	LatencyStats moving;
+	LatencyStats still;
+	for (int frame = 0; frame < frames; ++frame)
+	{
+		fill(0.01f * (frame + 1));
+		auto begin = std::chrono::steady_clock::now();
+		layout.layout();
+		moving.record(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count());
+		layout.run();
+	}
+	for (int frame = 0; frame < frames; ++frame)
+	{
+		fill(0.01f * frames);
+		auto begin = std::chrono::steady_clock::now();
+		layout.layout();
+		still.record(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count());
+		layout.run();
+	}
+
+	os << "Tile layout benchmark: " << tiles << " tiles in rows of " << columns << ", " << layout._changed.size() << " changed when still" << std::endl;
+	moving.report(os, "Tile layout pass, every tile moving");
+	still.report(os, "Tile layout pass, nothing moving");
+	os << "Tile layout per tile: " << moving.percentile(50.0) * 1e6 / (double)tiles << "ns moving, " << still.percentile(50.0) * 1e6 / (double)tiles << "ns still" << std::endl;
+}
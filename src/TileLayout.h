@@ -0,0 +1,63 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+#include <vxt/LinearAlgebra.h>
+#include "Stats.h"
+
+class ImagePlane;
+
+//Screen positions of the live tiles, worked out together once the grid has been walked rather
+//than tile by tile.  Rows give their origin, tiles their column, and one pass over the columns
+//turns them into positions.  Only planes whose position or selection differs from the last
+//frame are told, and only they rewrite their quad.
+class TileLayout
+{
+public:
+	void begin();
+	//Where column 0 of the row would be, scroll and animation included
+	void addRow(const glm::vec2& origin);
+	//Acquired is a plane new to the tile this frame, it is positioned whatever the last frame had
+	void add(ImagePlane* plane, int column, bool selected, bool acquired);
+	//Positions everything added since begin, returns how many planes changed
+	size_t run();
+
+	void report(std::ostream& os) const;
+
+	//CPU time of the pass over this many tiles, every tile moving and then none
+	static void benchmark(size_t tiles, std::ostream& os);
+
+private:
+	//Positions and the entries that changed, the planes are not touched
+	void layout();
+
+	struct RowRun
+	{
+		glm::vec2 origin;
+		uint32_t begin;
+		uint32_t end;
+	};
+
+	std::vector<RowRun> _rows;
+	//by entry, in the order the tiles were added
+	std::vector<float> _columns;
+	std::vector<uint8_t> _selected;
+	std::vector<uint8_t> _acquired;
+	std::vector<ImagePlane*> _planes;
+	std::vector<float> _x;
+	std::vector<float> _y;
+	//the last frame's, compared by entry; planes there are only compared, never used
+	std::vector<uint8_t> _previousSelected;
+	std::vector<ImagePlane*> _previousPlanes;
+	std::vector<float> _previousX;
+	std::vector<float> _previousY;
+	std::vector<uint8_t> _dirty;
+	std::vector<uint32_t> _changed;
+
+	size_t _tiles = 0;
+	size_t _peakChanged = 0;
+	uint64_t _frames = 0;
+	uint64_t _changedTotal = 0;
+	LatencyStats _layoutTime;
+};
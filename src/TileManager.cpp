@@ -1,129 +1,114 @@
 #include "TileManager.h"
 #include "RemoteAccess.h"
+#include "CatalogParser.h"
+#include "GridSnapshot.h"
+#include <cmath>
+#include <deque>
 #include <iostream>
+#include <unordered_map>
 #include <vkl/Window.h>
 #include <vkl/Event.h>
 
 namespace {
 	constexpr const char* JSONHomePage = "https://cd-static.bamgrid.com/dp-117731241344/home.json";
-	constexpr const char* RefPrefix = "https://cd-static.bamgrid.com/dp-117731241344/sets/";
 
-	constexpr std::string_view RowClassName = "CuratedSet";
-	constexpr std::string_view RowClassNameTrending = "TrendingSet";
-	constexpr std::string_view RowClassNameRefSet = "SetRef";
-	constexpr std::string_view SeriesClassName = "DmcSeries";
-	constexpr std::string_view VideoClassName = "DmcVideo";
-	constexpr std::string_view CollectionClassName = "StandardCollection";
-	static const std::string ClassTypeName = "type";
-
-	void _parse(const nlohmann::json& json, Grid& grid, Row* row)
+	//Rows are matched by their ref set URL, or their title when the tiles are inline
+	std::string rowKey(const Row& row)
 	{
-		if (json.contains(ClassTypeName))
-		{
-			std::string classType = json[ClassTypeName].get<std::string>();
-			if (classType == RowClassName || classType == RowClassNameTrending || classType == "PersonalizedCuratedSet")
-			{
-				Row row_inner;
-				row_inner.title = json["text"]["title"]["full"]["set"]["default"]["content"]; //not permanant
-				for (auto&& child : json)
-					_parse(child, grid, &row_inner);
-				grid._rows.push_back(std::move(row_inner));
-				return;
-			}
-			else if (classType == RowClassNameRefSet)
-			{
-				Row row_inner;
-				row_inner.title = json["text"]["title"]["full"]["set"]["default"]["content"]; //not permanant
-				row_inner.isRefSet = true;
-				row_inner.setId = json["refId"];
-				row_inner.setId = std::string(RefPrefix) + row_inner.setId + ".json";
-				grid._rows.push_back(std::move(row_inner));
-				return;
-			}
-			else if (classType == SeriesClassName)
-			{
-				Tile tile_inner;
-				tile_inner.data().title = json["text"]["title"]["full"]["series"]["default"]["content"]; //not permanant
-				const auto& tileObj = json["image"]["tile"];
-				if (!tileObj.empty())
-				{
-					tile_inner.data().imageURL = tileObj.back()["series"]["default"]["url"];
-				}
-
-				tile_inner.data().type = "Series";
-				tile_inner.data().language = json["text"]["title"]["full"]["series"]["default"]["language"];
-				if(json["ratings"].size() > 0)
-					tile_inner.data().rating = json["ratings"].front()["value"];
-
-				if (row)
-					row->_tiles.push_back(std::move(tile_inner));
-				return;
-			}
-			else if (classType == VideoClassName)
-			{
-				Tile tile_inner;
-				tile_inner.data().title = json["text"]["title"]["full"]["program"]["default"]["content"]; //not permanant
-				const auto& tileObj = json["image"]["tile"];
-				if (!tileObj.empty())
-				{
-					tile_inner.data().imageURL = tileObj.back()["program"]["default"]["url"];
-				}
-				tile_inner.data().type = "Movie";
-				tile_inner.data().language = json["text"]["title"]["full"]["program"]["default"]["language"];
-				if (json["ratings"].size() > 0)
-					tile_inner.data().rating = json["ratings"].front()["value"];
-
-				if (row)
-					row->_tiles.push_back(std::move(tile_inner));
-				return;
-			}
-			else if (classType == CollectionClassName && !json.contains("containers"))
-			{
-				Tile tile_inner;
-				tile_inner.data().title = json["text"]["title"]["full"]["collection"]["default"]["content"]; //not permanant
+		return row.isRefSet ? row.setId : row.title;
+	}
 
-				const auto& tileObj = json["image"]["tile"];
-				if (!tileObj.empty())
-				{
-					tile_inner.data().imageURL = tileObj.back()["default"]["default"]["url"];
-				}
-				tile_inner.data().type = "Collection";
-				if (row)
-					row->_tiles.push_back(std::move(tile_inner));
-				return;
-			}
-		}
+	bool sameTile(const TileData& a, const TileData& b)
+	{
+		return a.title() == b.title() && a.type() == b.type() && a.language() == b.language() &&
+			a.rating() == b.rating() && a.imageURL() == b.imageURL();
+	}
 
-		if (!json.is_object() && !json.is_array())
+	void eraseRenderObjects(std::vector<std::shared_ptr<vkl::RenderObject>>& renderObjects, const std::unordered_set<const vkl::RenderObject*>& objects)
+	{
+		if (objects.empty())
 			return;
+		renderObjects.erase(std::remove_if(renderObjects.begin(), renderObjects.end(), [&objects](const std::shared_ptr<vkl::RenderObject>& ro) { return objects.count(ro.get()) > 0; }), renderObjects.end());
+	}
 
-		for (auto&& child : json.items())
-			_parse(child.value(), grid, row);
-
-	} 
-}
-
-TileManager::TileManager()
-{
-	_jsonString = receiveStringResource(JSONHomePage);
-	_mainPageJson = nlohmann::json::parse(_jsonString);
-	parse(_mainPageJson);
-	for (auto&& row : _grid._rows)
+	void logRow(const Row& row)
 	{
 		std::cout << "Row: " << row.title << ": " << std::endl;
 		for (auto&& tile : row._tiles)
 		{
-			std::cout << "Title: " << tile.data().title << ", ";
+			std::cout << "Title: " << tile.data().title() << ", ";
 		}
 		std::cout << std::endl;
 	}
 }
 
+TileManager::TileManager(const vkl::Window& window)
+{
+	//the parser picks image variants for this size, so it has to be known before anything is parsed
+	updateImageTarget(window);
+
+	auto loadBegin = std::chrono::steady_clock::now();
+	if (GridSnapshot::load(GridSnapshot::defaultPath(), _grid, _homeFingerprint))
+	{
+		_loadedFromSnapshot = true;
+		_homeComplete = true;
+		std::cout << "Loaded home page snapshot in " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - loadBegin).count() << "ms" << std::endl;
+		for (auto&& row : _grid._rows)
+			logRow(row);
+		//the snapshot is shown straight away, the live page is fetched behind it and merged in if it changed
+		startRefresh();
+		prefetchRefSets();
+		return;
+	}
+
+	//nothing to show yet, placeholder rows hold the layout until update() swaps real rows in as they are parsed
+	for (int i = 0; i < TileData::visible_tiles; ++i)
+	{
+		Row row;
+		row.placeholder = true;
+		row._tiles.resize(TileData::visible_tiles_horizontal);
+		_grid._rows.push_back(std::move(row));
+	}
+
+	_homeStream = std::make_shared<HomeStream>();
+	_homeLoad = FetchScheduler::instance().submit(FetchPriority::Visible, [stream = _homeStream]() {
+		return streamResource(JSONHomePage, [&stream](std::istream& json) {
+			parseCatalog(json, [&stream](Row&& row) {
+				std::lock_guard lock(stream->mutex);
+				stream->rows.push_back(std::move(row));
+				});
+			});
+		});
+}
+
+void TileManager::updateImageTarget(const vkl::Window& window)
+{
+	//artwork is fetched and decoded no larger than a selected tile is drawn at this window size
+	auto windowSize = window.getWindowSize();
+	ImageCache::instance().setTargetSize(
+		(uint32_t)std::ceil(TileData::tile_width * TileData::selected_scale * .5f * windowSize.width),
+		(uint32_t)std::ceil(TileData::tile_height * TileData::selected_scale * .5f * windowSize.height));
+}
+
+void TileManager::setRefSetLookahead(int rows)
+{
+	_refSetLookahead = rows;
+}
+
 void TileManager::update(const vkl::Device& device, const vkl::SwapChain& swapChain, const vkl::PipelineManager& pipelines, vkl::BufferManager& bufferManager, std::vector<std::shared_ptr<vkl::RenderObject>>& renderObjects, const vkl::Window& window)
 {
+	auto updateBegin = std::chrono::steady_clock::now();
+
+	updateImageTarget(window);
+
+	receiveHomeRows(renderObjects);
+	applyRefresh(renderObjects);
+	if (!_homeStream && !_refresh.valid() && std::chrono::steady_clock::now() - _lastRefresh >= (_homeComplete ? _refreshInterval : _homeRetry))
+		startRefresh();
+
 	for (auto&& event : window.events())
 	{
-		if (event->getType() == vkl::EventType::KEY_DOWN)
+		if (event->getType() == vkl::EventType::KEY_DOWN && !_grid._rows.empty())
 		{
 			auto keyDown = static_cast<const vkl::KeyDownEvent*>(event.get());
 			switch (keyDown->key)
@@ -171,15 +156,15 @@ void TileManager::update(const vkl::Device& device, const vkl::SwapChain& swapCh
 					std::string text;
 					const auto& tile = _grid._rows[_highlighted.y]._tiles[_highlighted.x];
 					text += "Title: \n";
-					text += tile.data().title + "\n";
+					text += std::string(tile.data().title()) + "\n";
 					text += "Type: \n";
-					text += tile.data().type + "\n";
+					text += std::string(tile.data().typeName()) + "\n";
 					text += "Language: \n";
-					text += tile.data().language + "\n";
+					text += std::string(tile.data().language()) + "\n";
 					text += "Rating: \n";
-					text += tile.data().rating + "\n";
+					text += std::string(tile.data().rating()) + "\n";
 
-					_popup = std::make_shared<TextBox>(device, swapChain, pipelines, bufferManager);
+					_popup = _renderPool.acquireTextBox(device, swapChain, pipelines, bufferManager);
 					_popup->setBackground({ 0,0,0,1 });
 					_popup->setPosition({ -.5, -.5 });
 					_popup->setText(text);
@@ -193,6 +178,7 @@ void TileManager::update(const vkl::Device& device, const vkl::SwapChain& swapCh
 				{
 					renderObjects.erase(
 						std::remove(renderObjects.begin(), renderObjects.end(), _popup), renderObjects.end());
+					_renderPool.release(std::move(_popup));
 					_popup = nullptr;
 				}
 			}
@@ -206,31 +192,45 @@ void TileManager::update(const vkl::Device& device, const vkl::SwapChain& swapCh
 	float y = -1.f + TileData::tile_gap_vertical - (_screenOffset * (TileData::tile_height + (TileData::tile_gap_vertical+TileData::tile_gap_horizontal))) + _animatedOffset;
 
 	int y_pos = 0;
+	int visibleTiles = 0;
+	int visibleTilesLoaded = 0;
+	int visibleContentTiles = 0;
+	int liveTiles = 0;
+	int totalTiles = 0;
+
+	prefetchRefSets();
+
+	//only rows and columns within the margin of the visible window get render objects
+	int firstRow = _screenOffset - _renderMargin;
+	int lastRow = _screenOffset + TileData::visible_tiles - 1 + _renderMargin;
+	Retired retired;
+	bool scrolling = _animatedOffset != 0.f;
+	_layout.begin();
 
 	for (auto& row : _grid._rows)
 	{
 		if (row._tiles.empty())
 		{
-			if (isRowVisible(_screenOffset, y_pos))
-			{
-				if (loadRefSet(row))
-				{
-					std::cout << "Populated Ref Set" << std::endl;
-				}
-			}
+			continue;
 		}
-		if (row._tiles.empty())
+		totalTiles += (int)row._tiles.size();
+
+		if (y_pos < firstRow || y_pos > lastRow)
 		{
+			retireRow(row, retired);
+			if (!row.title.empty())
+				y += TileData::tile_gap_horizontal;
+			y += TileData::tile_height + TileData::tile_gap_vertical;
+			y_pos++;
 			continue;
 		}
 
 		float x = -1.f + TileData::tile_gap_horizontal;
-		int x_pos = 0;
 		if (!row.title.empty())
 		{
 			if (!row.textBox)
 			{
-				row.textBox = std::make_shared<TextBox>(device, swapChain, pipelines, bufferManager);
+				row.textBox = _renderPool.acquireTextBox(device, swapChain, pipelines, bufferManager);
 				row.textBox->setText(row.title);
 				renderObjects.push_back(row.textBox);
 			}
@@ -240,70 +240,572 @@ void TileManager::update(const vkl::Device& device, const vkl::SwapChain& swapCh
 		}
 
 		row.updateAnimation();
+		scrolling = scrolling || row.animatedOffset != 0.f;
 		x -= (row.offset * (TileData::tile_width + TileData::tile_gap_horizontal)) - row.animatedOffset;
 
-		for (auto&& tile : row._tiles)
+		int firstColumn = std::max(0, row.offset - _renderMargin);
+		int lastColumn = std::min((int)row._tiles.size() - 1, row.offset + TileData::visible_tiles_horizontal - 1 + _renderMargin);
+		retireTiles(row, row.liveBegin, std::min(row.liveEnd, firstColumn));
+		retireTiles(row, std::max(row.liveBegin, lastColumn + 1), row.liveEnd);
+		row.liveBegin = firstColumn;
+		row.liveEnd = std::max(firstColumn, lastColumn + 1);
+
+		_layout.addRow({ x,y });
+		for (int x_pos = firstColumn; x_pos <= lastColumn; ++x_pos)
 		{
-			if(tile._imagePlane)
-				tile._imagePlane->setSelected(_highlighted.x == x_pos && _highlighted.y == y_pos);
-			tile.update(device, swapChain, pipelines, bufferManager, { x,y }, renderObjects);
-			x += TileData::tile_width + TileData::tile_gap_horizontal;
-			x_pos++;
+			auto& tile = row._tiles[x_pos];
+			int distance = 0;
+			auto priority = tilePriority(row, x_pos, y_pos, distance);
+			bool acquired = tile.update(_batch, priority, distance);
+			_layout.add(tile._imagePlane.get(), x_pos, _highlighted.x == x_pos && _highlighted.y == y_pos, acquired);
+			_residency.track(tile, priority, distance, windowDistance(row, x_pos, y_pos));
+			liveTiles++;
+			if (priority == FetchPriority::Visible)
+			{
+				visibleTiles++;
+				if (!row.placeholder)
+					visibleContentTiles++;
+				if (tile._imagePlane->hasImage())
+					visibleTilesLoaded++;
+			}
 		}
 		y += TileData::tile_height + TileData::tile_gap_vertical;
 		y_pos++;
 	}
 
+	_layout.run();
+	_batch.submit(device, swapChain, bufferManager, renderObjects);
+	release(renderObjects, retired);
+	_liveTiles = liveTiles;
+	_totalTiles = totalTiles;
+	_peakLiveTiles = std::max(_peakLiveTiles, liveTiles);
+	_retiredRenderObjects += retired.objects.size();
+
+	_residency.update(_batch);
+	recordScrolling(scrolling);
+
+	if (_firstFrame == 0.0)
+	{
+		_firstFrame = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - processStart()).count();
+		std::cout << "First frame " << _firstFrame << "ms after process start" << std::endl;
+	}
+
+	if (_firstContent == 0.0 && visibleContentTiles > 0)
+	{
+		_firstContent = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - processStart()).count();
+		std::cout << "First content " << _firstContent << "ms after process start" << (_loadedFromSnapshot ? " (snapshot)" : " (network)") << std::endl;
+	}
+
+	if (!_visibleTilesReported && visibleTiles > 0 && visibleTiles == visibleTilesLoaded)
+	{
+		_visibleTilesReported = true;
+		std::cout << "Visible tiles loaded in " << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - _created).count() << "ms" << std::endl;
+	}
+
 	if (_popup)
 	{
 		_popup->update({ 0,0, window.getWindowSize().width, window.getWindowSize().height });
 	}
+
+	recordUploads(scrolling);
+	_updateTime.record(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - updateBegin).count());
+}
+
+void TileManager::report(std::ostream& os) const
+{
+	_updateTime.report(os, "TileManager::update");
+	_refSetHandoverTime.report(os, "Ref set handover");
+	_refreshApplyTime.report(os, "Catalog refresh merge");
+	os << "First frame: " << _firstFrame << "ms after process start" << std::endl;
+	os << "First content: " << _firstContent << "ms after process start" << (_loadedFromSnapshot ? " (snapshot)" : " (network)") << std::endl;
+	os << "Virtualized grid: " << _liveTiles << " of " << _totalTiles << " tiles live, peak " << _peakLiveTiles << ", margin " << _renderMargin << ", "
+		<< _retiredRenderObjects << " render objects retired" << std::endl;
+	_residency.report(os);
+	_renderPool.report(os);
+	_layout.report(os);
+	_batch.report(os);
+	os << "GPU uploads: " << _frameUploads << " last frame, peak " << _peakFrameUploads << ", " << _quietFrames << " of " << _frames << " frames with none, "
+		<< (_stillFrames ? (double)_stillFrameUploads / (double)_stillFrames : 0.0) << " per frame while the grid is still" << std::endl;
+	os << "GPU buffer allocations: " << bufferAllocations() << " in total, " << _scrollBufferAllocations << " over " << _scrollSeconds << "s of scrolling ("
+		<< (_scrollSeconds > 0.0 ? _scrollBufferAllocations / _scrollSeconds : 0.0) << " per second)" << std::endl;
+}
+
+void TileManager::saveSnapshot() const
+{
+	//a half streamed or failed page would stand in for the whole one next launch
+	if (_grid._rows.empty() || !_homeComplete)
+	{
+		std::cout << "Home page never loaded in full, snapshot not saved" << std::endl;
+		return;
+	}
+	if (GridSnapshot::save(_grid, _homeFingerprint, GridSnapshot::defaultPath()))
+		std::cout << "Saved home page snapshot" << std::endl;
+}
+
+void TileManager::receiveHomeRows(std::vector<std::shared_ptr<vkl::RenderObject>>& renderObjects)
+{
+	if (!_homeStream)
+		return;
+
+	//checked before taking the rows, so once the job is done everything it parsed is in this batch
+	bool finished = _homeLoad.ready();
+	std::vector<Row> arrived;
+	{
+		std::lock_guard lock(_homeStream->mutex);
+		arrived.swap(_homeStream->rows);
+	}
+
+	//real rows go in ahead of the placeholders, each one retiring a placeholder from the bottom
+	Retired retired;
+	for (auto&& row : arrived)
+	{
+		logRow(row);
+		_grid._rows.insert(_grid._rows.begin() + _homeRowsReceived, std::move(row));
+		_homeRowsReceived++;
+		if (_grid._rows.back().placeholder)
+		{
+			retireRow(_grid._rows.back(), retired);
+			_grid._rows.pop_back();
+		}
+	}
+
+	if (finished)
+	{
+		_homeComplete = _homeLoad.get();
+		if (!_homeComplete)
+			std::cerr << "Home page failed to load, retrying in " << _homeRetry.count() << "s" << std::endl;
+		while (!_grid._rows.empty() && _grid._rows.back().placeholder)
+		{
+			retireRow(_grid._rows.back(), retired);
+			_grid._rows.pop_back();
+		}
+		_homeStream = nullptr;
+		_homeFingerprint = GridSnapshot::fingerprint(_grid);
+		_lastRefresh = std::chrono::steady_clock::now();
+		if (_homeComplete)
+			std::cout << "Streamed home page in " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - _created).count() << "ms" << std::endl;
+
+		_highlighted.y = std::max(0, std::min(_highlighted.y, (int)_grid._rows.size() - 1));
+		_screenOffset = std::max(0, std::min(_screenOffset, (int)_grid._rows.size() - TileData::visible_tiles + 1));
+	}
+
+	release(renderObjects, retired);
+}
+
+void TileManager::setRefreshInterval(std::chrono::seconds interval)
+{
+	_refreshInterval = interval;
+}
+
+void TileManager::setRenderMargin(int tiles)
+{
+	_renderMargin = std::max(0, tiles);
+}
+
+void TileManager::setTextureDistance(int tiles)
+{
+	_residency.setDistance(tiles);
+}
+
+void TileManager::setTextureBudget(size_t bytes)
+{
+	_residency.setBudget(bytes);
+}
+
+void TileManager::startRefresh()
+{
+	//documents this process has not re-parsed yet are parsed even on a 304, the grid may have been
+	//built from an older copy than the one the cache revalidated in the background
+	std::vector<std::pair<std::string, bool>> refSets;
+	for (auto&& row : _grid._rows)
+	{
+		if (row.refSetResolved)
+			refSets.emplace_back(row.setId, !_refreshed.count(row.setId));
+	}
+
+	_lastRefresh = std::chrono::steady_clock::now();
+	_refresh = FetchScheduler::instance().submit(FetchPriority::Prefetch, [refSets = std::move(refSets), forceHome = !_refreshed.count(JSONHomePage)]() {
+		Refresh refresh;
+		std::string body;
+		bool modified = false;
+		if (revalidateResource(JSONHomePage, body, modified) && (modified || forceHome))
+		{
+			refresh.homeParsed = parseCatalog(body, [&refresh](Row&& row) { refresh.home._rows.push_back(std::move(row)); });
+		}
+
+		for (auto&& [url, force] : refSets)
+		{
+			if (FetchTicket::currentCancelled())
+				break;
+			std::vector<Tile> tiles;
+			if (revalidateResource(url.c_str(), body, modified) && (modified || force) && parseRefSet(body, tiles))
+				refresh.refSets[url] = std::move(tiles);
+		}
+		return refresh;
+		});
+}
+
+void TileManager::applyRefresh(std::vector<std::shared_ptr<vkl::RenderObject>>& renderObjects)
+{
+	if (!_refresh.ready())
+		return;
+
+	auto applyBegin = std::chrono::steady_clock::now();
+	auto refresh = _refresh.get();
+
+	//remembered by identity so the selection follows its tile if rows or tiles move
+	std::string highlightedRow;
+	uint64_t highlightedTile = 0;
+	bool hasHighlightedTile = false;
+	if (_highlighted.y >= 0 && _highlighted.y < (int)_grid._rows.size())
+	{
+		auto& row = _grid._rows[_highlighted.y];
+		highlightedRow = rowKey(row);
+		if (_highlighted.x >= 0 && _highlighted.x < (int)row._tiles.size())
+		{
+			highlightedTile = row._tiles[_highlighted.x].data().contentKey();
+			hasHighlightedTile = true;
+		}
+	}
+
+	DiffStats stats;
+	Retired stale;
+
+	if (!_homeComplete && !refresh.homeParsed)
+	{
+		_homeRetry = std::min(_homeRetry * 2, _refreshInterval);
+		std::cerr << "Home page failed to load again, retrying in " << _homeRetry.count() << "s" << std::endl;
+	}
+	if (refresh.homeParsed)
+	{
+		_homeComplete = true;
+		_refreshed.insert(JSONHomePage);
+		auto fingerprint = GridSnapshot::fingerprint(refresh.home);
+		if (fingerprint != _homeFingerprint)
+		{
+			patchRows(std::move(refresh.home._rows), stale, stats);
+			_homeFingerprint = fingerprint;
+		}
+	}
+
+	for (auto&& [url, tiles] : refresh.refSets)
+	{
+		_refreshed.insert(url);
+		for (auto&& row : _grid._rows)
+		{
+			if (row.refSetResolved && row.setId == url)
+			{
+				if (patchTiles(row._tiles, std::move(tiles), stats))
+					row.resetLiveRange();
+				break;
+			}
+		}
+	}
+
+	release(renderObjects, stale);
+	if (!stats.changed())
+		return;
+
+	//keep the highlighted tile where it was on screen, moving the scroll offsets with it
+	int newY = -1;
+	for (int y = 0; y < (int)_grid._rows.size() && newY < 0; ++y)
+	{
+		if (!highlightedRow.empty() && rowKey(_grid._rows[y]) == highlightedRow)
+			newY = y;
+	}
+	if (newY >= 0)
+	{
+		_screenOffset += newY - _highlighted.y;
+		_highlighted.y = newY;
+		auto& row = _grid._rows[newY];
+		for (int x = 0; hasHighlightedTile && x < (int)row._tiles.size(); ++x)
+		{
+			if (row._tiles[x].data().contentKey() == highlightedTile)
+			{
+				row.offset += x - _highlighted.x;
+				_highlighted.x = x;
+				break;
+			}
+		}
+	}
+	_highlighted.y = std::max(0, std::min(_highlighted.y, (int)_grid._rows.size() - 1));
+	_screenOffset = std::max(0, std::min(_screenOffset, (int)_grid._rows.size() - TileData::visible_tiles + 1));
+	for (auto&& row : _grid._rows)
+		row.offset = std::max(0, std::min(row.offset, (int)row._tiles.size() - TileData::visible_tiles_horizontal + 1));
+	if (!_grid._rows.empty())
+		_highlighted.x = std::max(0, std::min(_highlighted.x, (int)_grid._rows[_highlighted.y]._tiles.size() - 1));
+
+	_refreshApplyTime.record(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - applyBegin).count());
+	std::cout << "Catalog refresh: rows +" << stats.rowsInserted << " -" << stats.rowsRemoved << " moved " << stats.rowsMoved << " retitled " << stats.rowsRetitled
+		<< ", tiles +" << stats.tilesInserted << " -" << stats.tilesRemoved << " moved " << stats.tilesMoved << " updated " << stats.tilesUpdated << std::endl;
 }
 
-void TileManager::parse(const nlohmann::json& json)
+void TileManager::patchRows(std::vector<Row>&& fresh, Retired& stale, DiffStats& stats)
 {
-	_parse(json, _grid, nullptr);
+	auto& rows = _grid._rows;
+	std::unordered_map<std::string, std::deque<size_t>> index;
+	for (size_t i = 0; i < rows.size(); ++i)
+		index[rowKey(rows[i])].push_back(i);
+
+	std::vector<bool> kept(rows.size(), false);
+	std::vector<Row> patched;
+	patched.reserve(fresh.size());
+	size_t lastMatched = 0;
+	for (auto&& freshRow : fresh)
+	{
+		auto itr = index.find(rowKey(freshRow));
+		if (itr == index.end() || itr->second.empty())
+		{
+			stats.rowsInserted++;
+			patched.push_back(std::move(freshRow));
+			continue;
+		}
+
+		auto position = itr->second.front();
+		itr->second.pop_front();
+		kept[position] = true;
+		if (position < lastMatched)
+			stats.rowsMoved++;
+		lastMatched = std::max(lastMatched, position);
+
+		auto& row = rows[position];
+		if (row.title != freshRow.title)
+		{
+			stats.rowsRetitled++;
+			row.title = freshRow.title;
+			if (row.textBox)
+				row.textBox->setText(row.title);
+		}
+		//ref set contents come from their own document, and a row whose tiles kept their places keeps
+		//its live range, so the next update only walks the window instead of the whole row
+		if (!row.isRefSet && patchTiles(row._tiles, std::move(freshRow._tiles), stats))
+			row.resetLiveRange();
+		patched.push_back(std::move(row));
+	}
+
+	for (size_t i = 0; i < rows.size(); ++i)
+	{
+		if (kept[i])
+			continue;
+		stats.rowsRemoved++;
+		retireRow(rows[i], stale);
+	}
+	rows = std::move(patched);
 }
 
-bool TileManager::isRowVisible(int yOffset, int y)
+bool TileManager::patchTiles(std::vector<Tile>& tiles, std::vector<Tile>&& fresh, DiffStats& stats)
+{
+	bool reordered = false;
+	std::unordered_map<uint64_t, std::deque<size_t>> index;
+	for (size_t i = 0; i < tiles.size(); ++i)
+		index[tiles[i].data().contentKey()].push_back(i);
+
+	std::vector<bool> kept(tiles.size(), false);
+	std::vector<Tile> patched;
+	patched.reserve(fresh.size());
+	size_t lastMatched = 0;
+	for (auto&& freshTile : fresh)
+	{
+		auto itr = index.find(freshTile.data().contentKey());
+		if (itr == index.end() || itr->second.empty())
+		{
+			stats.tilesInserted++;
+			reordered = true;
+			patched.push_back(std::move(freshTile));
+			continue;
+		}
+
+		auto position = itr->second.front();
+		itr->second.pop_front();
+		kept[position] = true;
+		if (position < lastMatched)
+			stats.tilesMoved++;
+		reordered = reordered || position != patched.size();
+		lastMatched = std::max(lastMatched, position);
+
+		//unchanged tiles keep their image plane, and with it the uploaded texture
+		auto& tile = tiles[position];
+		if (!sameTile(tile.data(), freshTile.data()))
+		{
+			stats.tilesUpdated++;
+			if (tile.data().imageURL() != freshTile.data().imageURL())
+				tile._imagePlane = nullptr;
+			tile.data() = freshTile.data();
+		}
+		patched.push_back(std::move(tile));
+	}
+
+	for (size_t i = 0; i < tiles.size(); ++i)
+	{
+		if (kept[i])
+			continue;
+		stats.tilesRemoved++;
+		reordered = true;
+	}
+	tiles = std::move(patched);
+	return reordered;
+}
+
+bool TileManager::isRowVisible(int yOffset, int y) const
 {
 	if (y >= yOffset && y < yOffset + TileData::visible_tiles)
 		return true;
 	return false;
 }
 
-bool TileManager::loadRefSet(Row& load)
+FetchPriority TileManager::tilePriority(const Row& row, int x, int y, int& distance) const
 {
-	if (load.setId.empty())
-		return false;
+	distance = std::abs(x - _highlighted.x) + std::abs(y - _highlighted.y);
+	bool columnVisible = x >= row.offset && x < row.offset + TileData::visible_tiles_horizontal;
+	if (columnVisible && isRowVisible(_screenOffset, y))
+		return FetchPriority::Visible;
+	if (std::abs(y - _highlighted.y) <= 1)
+		return FetchPriority::Neighbour;
+	return FetchPriority::Prefetch;
+}
 
-	if (!load._futureJSON.valid())
+void TileManager::retireTiles(Row& row, int begin, int end)
+{
+	//planes give their quad and texture cell back to the batch as they go
+	for (int x = begin; x < end; ++x)
 	{
-		load._futureJSON = std::move(std::async(std::launch::async | std::launch::deferred, [url= load.setId]() -> std::string {
-			return receiveStringResource(url.c_str());
-			}));
-		return false;
+		auto& tile = row._tiles[x];
+		if (!tile._imagePlane)
+			continue;
+		_residency.retire(tile);
+		tile._imagePlane = nullptr;
 	}
-	
-	if (load._futureJSON.wait_for(std::chrono::milliseconds(0)) != std::future_status::ready)
-		return false;
+	if (begin <= row.liveBegin && end >= row.liveEnd)
+		row.liveBegin = row.liveEnd = 0;
+}
+
+void TileManager::retireRow(Row& row, Retired& retired)
+{
+	retireTiles(row, row.liveBegin, row.liveEnd);
+	//tiles draw through the batch, only the title is a render object of its own
+	if (row.textBox)
+	{
+		retired.objects.insert(row.textBox.get());
+		retired.textBoxes.push_back(std::move(row.textBox));
+		row.textBox = nullptr;
+	}
+}
+
+void TileManager::release(std::vector<std::shared_ptr<vkl::RenderObject>>& renderObjects, Retired& retired)
+{
+	eraseRenderObjects(renderObjects, retired.objects);
+	for (auto&& textBox : retired.textBoxes)
+		_renderPool.release(std::move(textBox));
+	retired.textBoxes.clear();
+}
+
+void TileManager::recordScrolling(bool scrolling)
+{
+	//buffers allocated over frames where the grid is moving, the cost that pooling takes away
+	auto now = std::chrono::steady_clock::now();
+	auto allocations = bufferAllocations();
+	if (scrolling && _lastFrame != std::chrono::steady_clock::time_point{})
+	{
+		_scrollSeconds += std::chrono::duration<double>(now - _lastFrame).count();
+		_scrollBufferAllocations += allocations - _lastBufferAllocations;
+	}
+	_lastFrame = now;
+	_lastBufferAllocations = allocations;
+}
+
+void TileManager::recordUploads(bool scrolling)
+{
+	//a frame where nothing moved, loaded or changed should upload nothing at all
+	auto total = uploads();
+	_frameUploads = total - _lastUploads;
+	_lastUploads = total;
+	_peakFrameUploads = std::max(_peakFrameUploads, _frameUploads);
+	_frames++;
+	if (_frameUploads == 0)
+		_quietFrames++;
+	if (!scrolling)
+	{
+		_stillFrames++;
+		_stillFrameUploads += _frameUploads;
+	}
+}
 
-	load.setId = "";
+int TileManager::windowDistance(const Row& row, int x, int y) const
+{
+	int rows = 0;
+	if (y < _screenOffset)
+		rows = _screenOffset - y;
+	else if (y >= _screenOffset + TileData::visible_tiles)
+		rows = y - (_screenOffset + TileData::visible_tiles - 1);
+
+	int columns = 0;
+	if (x < row.offset)
+		columns = row.offset - x;
+	else if (x >= row.offset + TileData::visible_tiles_horizontal)
+		columns = x - (row.offset + TileData::visible_tiles_horizontal - 1);
+
+	return std::max(rows, columns);
+}
 
-	std::string refSetJsonStr = load._futureJSON.get();
-	load._futureJSON = {};
+void TileManager::prefetchRefSets()
+{
+	//y_pos mirrors the layout in update(), where rows without tiles take no space
+	int y_pos = 0;
+	for (auto& row : _grid._rows)
+	{
+		if (row._tiles.empty())
+		{
+			int distance = 0;
+			if (y_pos < _screenOffset)
+				distance = _screenOffset - y_pos;
+			else if (y_pos >= _screenOffset + TileData::visible_tiles)
+				distance = y_pos - (_screenOffset + TileData::visible_tiles - 1);
 
-	if (refSetJsonStr.empty())
+			if (distance == 0 || _refSetLookahead == all_rows || distance <= _refSetLookahead)
+			{
+				if (loadRefSet(row, distance == 0 ? FetchPriority::Visible : FetchPriority::Prefetch, distance))
+				{
+					std::cout << "Populated Ref Set" << std::endl;
+				}
+			}
+			else
+			{
+				//started while it was in the window, let it finish behind everything closer
+				row._pendingTiles.setPriority(FetchPriority::Prefetch, distance);
+			}
+		}
+
+		if (!row._tiles.empty())
+			y_pos++;
+	}
+}
+
+bool TileManager::loadRefSet(Row& load, FetchPriority priority, int distance)
+{
+	if (load.setId.empty() || load.refSetResolved)
 		return false;
-	auto refSetJson = nlohmann::json::parse(refSetJsonStr);
-	if(refSetJson["data"].contains("CuratedSet"))
-		_parse(refSetJson["data"]["CuratedSet"]["items"], _grid, &load);
-	else if (refSetJson["data"].contains("TrendingSet"))
-		_parse(refSetJson["data"]["TrendingSet"]["items"], _grid, &load);
-	else if (refSetJson["data"].contains("PersonalizedCuratedSet"))
-		_parse(refSetJson["data"]["PersonalizedCuratedSet"]["items"], _grid, &load);
-	assert(load._tiles.size());
-	return true;
+
+	if (!load._pendingTiles.valid())
+	{
+		load._pendingTiles = FetchScheduler::instance().submit(priority, [url= load.setId]() -> std::vector<Tile> {
+			std::vector<Tile> tiles;
+			streamResource(url.c_str(), [&tiles](std::istream& json) { parseRefSet(json, tiles); });
+			return tiles;
+			});
+		load._pendingTiles.setPriority(priority, distance);
+		return false;
+	}
+
+	load._pendingTiles.setPriority(priority, distance);
+	if (!load._pendingTiles.ready())
+		return false;
+
+	//the worker already downloaded and parsed the set, all that is left here is the move
+	auto handoverBegin = std::chrono::steady_clock::now();
+	load.refSetResolved = true;
+	load._tiles = load._pendingTiles.get();
+	_refSetHandoverTime.record(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - handoverBegin).count());
+	return !load._tiles.empty();
 }
 
 void TileManager::fixOffset(Row& row)
@@ -330,6 +832,9 @@ void TileManager::fixOffset()
 
 void TileManager::updateAnimation()
 {
+	//settled, nothing to move until the next reset
+	if (_animatedOffset == 0.f)
+		return;
 	constexpr const float animationTime = 300;
 	float delta = (float)std::chrono::duration_cast<std::chrono::milliseconds>((std::chrono::steady_clock::now() - _animationBegin)).count();
 	if (delta >= animationTime)
@@ -354,6 +859,8 @@ void TileManager::resetAnimation(float multiplier)
 
 void Row::updateAnimation()
 {
+	if (animatedOffset == 0.f)
+		return;
 	constexpr const float animationTime = 300;	
 	float delta = (float)std::chrono::duration_cast<std::chrono::milliseconds>((std::chrono::steady_clock::now() - _animationBegin)).count();
 	if (delta >= animationTime)
@@ -1,9 +1,15 @@
 #pragma once
+#include <mutex>
 #include <string>
-#include <nlohmann/json.hpp>
+#include <unordered_map>
+#include <unordered_set>
 #include "Tile.h"
 #include "TextBox.h"
-#include <future>
+#include "FetchScheduler.h"
+#include "Stats.h"
+#include "TextureResidency.h"
+#include "RenderObjectPool.h"
+#include "TileLayout.h"
 
 struct Row
 {
@@ -11,14 +17,22 @@ struct Row
 	std::string title;
 	std::vector<Tile> _tiles;
 	bool isRefSet{ false };
+	bool refSetResolved{ false };
+	//Stands in for a row of the home page until it has loaded
+	bool placeholder{ false };
 	std::shared_ptr<TextBox> textBox;
 	int offset = 0;
 	float animatedOffset = 0.f;
+	//Only tiles in [liveBegin, liveEnd) can have render objects
+	int liveBegin = 0;
+	int liveEnd = 0;
 
-	std::future<std::string> _futureJSON;
+	PendingFetch<std::vector<Tile>> _pendingTiles;
 
 	void updateAnimation();
 	void resetAnimation(float multiplier);
+	//After the tiles are reordered, until the next frame narrows it again
+	void resetLiveRange() { liveBegin = 0; liveEnd = (int)_tiles.size(); }
 
 	Row() = default;
 	~Row() = default;
@@ -39,15 +53,92 @@ struct Grid
 class TileManager
 {
 public:
-	TileManager();
+	explicit TileManager(const vkl::Window& window);
 	void update(const vkl::Device& device, const vkl::SwapChain& swapChain, const vkl::PipelineManager& pipelines, vkl::BufferManager& bufferManager, std::vector<std::shared_ptr<vkl::RenderObject>>& renderObjects, const vkl::Window& window);
 
+	void report(std::ostream& os) const;
+
+	//Writes the grid, including the ref sets resolved so far, for the next launch to start from
+	void saveSnapshot() const;
+
+	//Ref sets within this many rows of the visible window are fetched ahead of time, all_rows fetches every one
+	static constexpr inline int all_rows = -1;
+	static constexpr inline int default_ref_set_lookahead = 4;
+	void setRefSetLookahead(int rows);
+
+	//The home page and every resolved ref set are revalidated this often, and changes are merged into the live grid
+	static constexpr inline std::chrono::seconds default_refresh_interval{ 300 };
+	//A home page that failed to load is fetched again by a refresh this soon, the wait doubling
+	//after each failure up to the refresh interval
+	static constexpr inline std::chrono::seconds home_retry_delay{ 2 };
+	void setRefreshInterval(std::chrono::seconds interval);
+
+	//Rows and columns this far outside the visible window still get render objects, the rest have none
+	static constexpr inline int default_render_margin = 2;
+	void setRenderMargin(int tiles);
+
+	//Tile textures further than this many rows or columns outside the visible window are evicted, within it they stream back in
+	void setTextureDistance(int tiles);
+	//GPU memory for tile textures, past it the furthest go first
+	void setTextureBudget(size_t bytes);
+
 private:
-	void parse(const nlohmann::json& json);
+	struct Refresh
+	{
+		bool homeParsed = false;
+		Grid home;
+		//Only the ref sets that changed, or were not checked before, by URL
+		std::unordered_map<std::string, std::vector<Tile>> refSets;
+	};
 
-	bool isRowVisible(int yOffset, int y);
+	struct DiffStats
+	{
+		int rowsInserted = 0;
+		int rowsRemoved = 0;
+		int rowsMoved = 0;
+		int rowsRetitled = 0;
+		int tilesInserted = 0;
+		int tilesRemoved = 0;
+		int tilesMoved = 0;
+		int tilesUpdated = 0;
 
-	bool loadRefSet(Row& load);
+		bool changed() const { return rowsInserted || rowsRemoved || rowsMoved || rowsRetitled || tilesInserted || tilesRemoved || tilesMoved || tilesUpdated; }
+	};
+
+	//Rows handed over by the home page parser while it is still running
+	struct HomeStream
+	{
+		std::mutex mutex;
+		std::vector<Row> rows;
+	};
+
+	void updateImageTarget(const vkl::Window& window);
+	bool isRowVisible(int yOffset, int y) const;
+	FetchPriority tilePriority(const Row& row, int x, int y, int& distance) const;
+	int windowDistance(const Row& row, int x, int y) const;
+	//Text boxes leaving the window, or the grid, this frame, pooled once they are out of the render list
+	struct Retired
+	{
+		std::unordered_set<const vkl::RenderObject*> objects;
+		std::vector<std::shared_ptr<TextBox>> textBoxes;
+	};
+
+	void retireTiles(Row& row, int begin, int end);
+	//The row's planes and title, for rows scrolled out of the margin and rows leaving the grid
+	void retireRow(Row& row, Retired& retired);
+	//Takes the retired objects out of the render list and pools them
+	void release(std::vector<std::shared_ptr<vkl::RenderObject>>& renderObjects, Retired& retired);
+	void recordScrolling(bool scrolling);
+	void recordUploads(bool scrolling);
+
+	void receiveHomeRows(std::vector<std::shared_ptr<vkl::RenderObject>>& renderObjects);
+	void startRefresh();
+	void applyRefresh(std::vector<std::shared_ptr<vkl::RenderObject>>& renderObjects);
+	void patchRows(std::vector<Row>&& fresh, Retired& stale, DiffStats& stats);
+	//True when tiles were inserted, removed or moved, so the indices of the row's live range are stale
+	bool patchTiles(std::vector<Tile>& tiles, std::vector<Tile>&& fresh, DiffStats& stats);
+	void prefetchRefSets();
+	bool loadRefSet(Row& load, FetchPriority priority, int distance);
 	void fixOffset(Row& row);
 	void fixOffset();
 	void updateAnimation();
@@ -57,12 +148,54 @@ private:
 	float _animationOffsetBegin = 0.f;
 
 
-	std::string _jsonString;
-	nlohmann::json _mainPageJson;
+	//ahead of the grid, its image planes hold on to it
+	TileBatch _batch;
 	Grid _grid;
+	uint64_t _homeFingerprint = 0;
+	bool _loadedFromSnapshot = false;
+	std::shared_ptr<HomeStream> _homeStream;
+	PendingFetch<bool> _homeLoad;
+	int _homeRowsReceived = 0;
+	PendingFetch<Refresh> _refresh;
+	std::chrono::seconds _refreshInterval = default_refresh_interval;
+	std::chrono::steady_clock::time_point _lastRefresh = std::chrono::steady_clock::now();
+	//the whole home page is in the grid, from the snapshot, the stream or a refresh.  Until it is
+	//there is nothing worth saving, and refreshes run on the retry delay.
+	bool _homeComplete = false;
+	std::chrono::seconds _homeRetry = home_retry_delay;
+	std::unordered_set<std::string> _refreshed;
 	int _screenOffset = 0;
 	float _animatedOffset = 0.f;
 	glm::ivec2 _highlighted{ 0 ,0 };
+	int _refSetLookahead = default_ref_set_lookahead;
+	int _renderMargin = default_render_margin;
+	TextureResidency _residency;
+	RenderObjectPool _renderPool;
+	TileLayout _layout;
+
+	LatencyStats _updateTime;
+	LatencyStats _refSetHandoverTime;
+	LatencyStats _refreshApplyTime;
+
+	std::chrono::steady_clock::time_point _created = std::chrono::steady_clock::now();
+	bool _visibleTilesReported = false;
+	double _firstFrame = 0.0;
+	double _firstContent = 0.0;
+	int _liveTiles = 0;
+	int _totalTiles = 0;
+	int _peakLiveTiles = 0;
+	uint64_t _retiredRenderObjects = 0;
+	std::chrono::steady_clock::time_point _lastFrame;
+	uint64_t _lastBufferAllocations = 0;
+	double _scrollSeconds = 0.0;
+	uint64_t _scrollBufferAllocations = 0;
+	uint64_t _lastUploads = 0;
+	uint64_t _frameUploads = 0;
+	uint64_t _peakFrameUploads = 0;
+	uint64_t _frames = 0;
+	uint64_t _quietFrames = 0;
+	uint64_t _stillFrames = 0;
+	uint64_t _stillFrameUploads = 0;
 
 	std::shared_ptr<TextBox> _popup;
 };
\ No newline at end of file
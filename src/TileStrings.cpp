@@ -0,0 +1,167 @@
+#include "TileStrings.h"
+#include <cstring>
+#include <functional>
+
+TileStrings& TileStrings::instance()
+{
+	static TileStrings strings;
+	return strings;
+}
+
+TileStrings::TileStrings() : _index(1024)
+{
+	//id 0 is always the empty string so default constructed data reads as empty
+	_vocabulary.push_back({});
+	_ids[{}] = 0;
+	_tags.push_back({});
+	_tagIds[{}] = 0;
+}
+
+uint32_t TileStrings::intern(std::string_view value)
+{
+	std::lock_guard lock(_mutex);
+	if (auto itr = _ids.find(value); itr != _ids.end())
+		return itr->second;
+
+	auto stored = storeLocked(value);
+	auto id = (uint32_t)_vocabulary.size();
+	_vocabulary.push_back(stored);
+	_ids[stored] = id;
+	return id;
+}
+
+std::string_view TileStrings::interned(uint32_t id) const
+{
+	std::lock_guard lock(_mutex);
+	return id < _vocabulary.size() ? _vocabulary[id] : std::string_view();
+}
+
+uint16_t TileStrings::internTag(std::string_view value)
+{
+	std::lock_guard lock(_mutex);
+	if (auto itr = _tagIds.find(value); itr != _tagIds.end())
+		return itr->second;
+	if (_tags.size() >= max_tags)
+	{
+		_droppedTags++;
+		return 0;
+	}
+
+	auto stored = storeLocked(value);
+	auto id = (uint16_t)_tags.size();
+	_tags.push_back(stored);
+	_tagIds[stored] = id;
+	return id;
+}
+
+std::string_view TileStrings::tag(uint16_t id) const
+{
+	std::lock_guard lock(_mutex);
+	return id < _tags.size() ? _tags[id] : std::string_view();
+}
+
+std::string_view TileStrings::store(std::string_view value)
+{
+	if (value.empty())
+		return {};
+	std::lock_guard lock(_mutex);
+	return storeLocked(value);
+}
+
+std::string_view TileStrings::storeLocked(std::string_view value)
+{
+	if (value.empty())
+		return {};
+	if (auto& slot = indexSlot(value); !slot.empty())
+	{
+		_reusedBytes += value.size();
+		return slot;
+	}
+
+	char* destination = nullptr;
+	if (value.size() > arena_block_size / 4)
+	{
+		//oversized strings get a block of their own so they do not waste the current one
+		_largeBlocks.push_back(std::make_unique<char[]>(value.size()));
+		destination = _largeBlocks.back().get();
+	}
+	else
+	{
+		if (_blocks.empty() || _blockUsed + value.size() > arena_block_size)
+		{
+			_blocks.push_back(std::make_unique<char[]>(arena_block_size));
+			_blockUsed = 0;
+		}
+		destination = _blocks.back().get() + _blockUsed;
+		_blockUsed += value.size();
+	}
+
+	std::memcpy(destination, value.data(), value.size());
+	_arenaBytes += value.size();
+	std::string_view stored(destination, value.size());
+	indexInsert(stored);
+	return stored;
+}
+
+std::string_view& TileStrings::indexSlot(std::string_view value)
+{
+	size_t mask = _index.size() - 1;
+	for (size_t i = std::hash<std::string_view>()(value) & mask;; i = (i + 1) & mask)
+	{
+		if (_index[i].empty() || _index[i] == value)
+			return _index[i];
+	}
+}
+
+void TileStrings::indexInsert(std::string_view value)
+{
+	//kept under 3/4 full so probes stay short
+	if ((_indexUsed + 1) * 4 > _index.size() * 3)
+	{
+		std::vector<std::string_view> old(_index.size() * 2);
+		old.swap(_index);
+		for (auto&& held : old)
+		{
+			if (!held.empty())
+				indexSlot(held) = held;
+		}
+	}
+
+	auto& slot = indexSlot(value);
+	if (slot.empty())
+	{
+		slot = value;
+		_indexUsed++;
+	}
+}
+
+void TileStrings::adopt(std::shared_ptr<const void> storage, const std::vector<std::string_view>& strings)
+{
+	std::lock_guard lock(_mutex);
+	_adopted.push_back(std::move(storage));
+	for (auto&& value : strings)
+	{
+		if (!value.empty())
+			indexInsert(value);
+	}
+}
+
+size_t TileStrings::arenaBytes() const
+{
+	std::lock_guard lock(_mutex);
+	return _arenaBytes;
+}
+
+size_t TileStrings::indexBytes() const
+{
+	std::lock_guard lock(_mutex);
+	return _index.capacity() * sizeof(std::string_view);
+}
+
+void TileStrings::report(std::ostream& os) const
+{
+	std::lock_guard lock(_mutex);
+	os << "Tile strings: " << _arenaBytes << " arena bytes in " << _blocks.size() + _largeBlocks.size() << " blocks, " << _indexUsed << " strings held in a "
+		<< _index.size() * sizeof(std::string_view) << " byte index, " << _reusedBytes << " bytes reused instead of copied, "
+		<< _vocabulary.size() << " interned strings, " << _tags.size() << " tags (" << _droppedTags << " dropped)" << std::endl;
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+//Backing store for the text of every TileData.  Small vocabularies (languages, ratings, URL heads and
+//tails) are interned once; one-off strings such as titles are copied into an append-only arena.
+//Nothing is ever freed, so views handed out stay valid for the life of the process.  A string that is
+//already held is handed back rather than copied again, so re-parsing a refreshed catalog only adds
+//the strings that changed.
+class TileStrings
+{
+public:
+	static constexpr inline size_t arena_block_size = 64 * 1024;
+
+	static TileStrings& instance();
+
+	uint32_t intern(std::string_view value);
+	std::string_view interned(uint32_t id) const;
+
+	//Languages and ratings, kept apart from the URL vocabulary so their ids fit TileData's 16 bits.
+	//Past max_tags distinct values new ones read back as empty.
+	static constexpr inline size_t max_tags = 1 << 16;
+	uint16_t internTag(std::string_view value);
+	std::string_view tag(uint16_t id) const;
+
+	std::string_view store(std::string_view value);
+
+	//Keeps memory that views were handed out into, such as a mapped snapshot, alive with the arena.
+	//strings in it are handed out by store() from then on.
+	void adopt(std::shared_ptr<const void> storage, const std::vector<std::string_view>& strings = {});
+
+	size_t arenaBytes() const;
+	//Memory of the table finding strings already held, next to the arena
+	size_t indexBytes() const;
+	void report(std::ostream& os) const;
+
+private:
+	TileStrings();
+
+	std::string_view storeLocked(std::string_view value);
+	//The slot holding value, or the empty slot it would go in
+	std::string_view& indexSlot(std::string_view value);
+	void indexInsert(std::string_view value);
+
+	mutable std::mutex _mutex;
+	std::vector<std::unique_ptr<char[]>> _blocks;
+	std::vector<std::unique_ptr<char[]>> _largeBlocks;
+	size_t _blockUsed = 0;
+	size_t _arenaBytes = 0;
+	size_t _reusedBytes = 0;
+	//Every string held, open addressed with linear probing so a string costs one view in the
+	//table rather than a heap node.  Empty views are free slots, the size is a power of two.
+	std::vector<std::string_view> _index;
+	size_t _indexUsed = 0;
+	std::vector<std::shared_ptr<const void>> _adopted;
+
+	std::deque<std::string_view> _vocabulary;
+	std::unordered_map<std::string_view, uint32_t> _ids;
+
+	std::vector<std::string_view> _tags;
+	std::unordered_map<std::string_view, uint16_t> _tagIds;
+	size_t _droppedTags = 0;
+};
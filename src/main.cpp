@@ -13,9 +13,74 @@
 
 #include "Background.h"
 #include "TileManager.h"
+#include "RemoteAccess.h"
+#include "FetchScheduler.h"
+#include "DecodePool.h"
+#include "DiskCache.h"
+#include "ImageCache.h"
+#include "TileLayout.h"
+#include "BlockCompression.h"
+#include "CatalogParser.h"
+#include "ImageDecoder.h"
+#include "PixelKernels.h"
+#include "Stats.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
 
 int main(int argc, char* argv[])
 {
+	if (argc > 1 && std::string_view(argv[1]) == "--benchmark-layout")
+	{
+		TileLayout::benchmark(100000, std::cout);
+		return 0;
+	}
+	if (argc > 1 && std::string_view(argv[1]) == "--benchmark-tiles")
+	{
+		TileData::benchmark(100000, std::cout);
+		return 0;
+	}
+	if (argc > 1 && std::string_view(argv[1]) == "--benchmark-scheduler")
+	{
+		FetchScheduler::benchmark(50, std::cout);
+		return 0;
+	}
+	//Recorded home.json and sets/<refId>.json documents saved from the CDN
+	if (argc > 1 && std::string_view(argv[1]) == "--benchmark-parse")
+	{
+		benchmarkCatalogParse(std::vector<std::string>(argv + 2, argv + argc), std::cout);
+		return 0;
+	}
+	//Tile JPEGs, decoded for a selected tile in the startup window
+	if (argc > 1 && std::string_view(argv[1]) == "--benchmark-decode")
+	{
+		benchmarkDecode(std::vector<std::string>(argv + 2, argv + argc),
+			(uint32_t)std::ceil(TileData::tile_width * TileData::selected_scale * .5f * 1080.f),
+			(uint32_t)std::ceil(TileData::tile_height * TileData::selected_scale * .5f * 720.f), std::cout);
+		return 0;
+	}
+	if (argc > 1 && std::string_view(argv[1]) == "--benchmark-kernels")
+	{
+		benchmarkPixelKernels(std::cout);
+		return 0;
+	}
+	if (argc > 1 && std::string_view(argv[1]) == "--benchmark-bc1")
+	{
+		benchmarkBC1(std::vector<std::string>(argv + 2, argv + argc), std::cout);
+		return 0;
+	}
+	//Point it at a local keep-alive stand-in for the CDN serving one tile image
+	if (argc > 1 && std::string_view(argv[1]) == "--benchmark-http")
+	{
+		HttpClient::benchmark(argc > 2 ? argv[2] : "http://127.0.0.1:8000/tile.jpg", 500, std::cout);
+		return 0;
+	}
+
 	vkl::Instance instance("disney_streaming", false);
 
 	vkl::Window window(1080, 720, "Disney Streaming");
@@ -44,7 +109,9 @@ int main(int argc, char* argv[])
 	auto bg = std::make_shared<Background>(device, swapChain, pipelineManager, bufferManager);
 	renderObjects.push_back(bg);
 
-	TileManager mgr;
+	TileManager mgr(window);
+	LatencyStats submitTime;
+	size_t peakRenderObjects = 0;
 
 	while (!window.shouldClose())
 	{
@@ -55,12 +122,27 @@ int main(int argc, char* argv[])
 		mgr.update(device, swapChain, pipelineManager, bufferManager, renderObjects, window);
 
 		bufferManager.update(device, swapChain);
+		auto submitBegin = std::chrono::steady_clock::now();
 		commandDispatcher.processUnsortedObjects(renderObjects, device, pipelineManager, mainPass, swapChain, swapChain.frameBuffer(swapChain.frame()), swapChain.swapChainExtent());
+		submitTime.record(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - submitBegin).count());
+		peakRenderObjects = std::max(peakRenderObjects, renderObjects.size());
 		swapChain.swap(device, surface, commandDispatcher, mainPass, window.getWindowSize());
 		//window.bufferManager.cleanUnusedBuffers(window.device);
 	}
 
 	device.waitIdle();
+
+	mgr.report(std::cout);
+	std::cout << "Render objects: " << renderObjects.size() << ", peak " << peakRenderObjects << " (background, row titles and tile pages, one draw each; tiles are batched up to 8 a page, see Tile batch)" << std::endl;
+	submitTime.report(std::cout, "Frame command recording");
+	HttpClient::instance().report(std::cout);
+	FetchScheduler::instance().report(std::cout);
+	DecodePool::instance().report(std::cout);
+	DiskCache::instance().report(std::cout);
+	ImageCache::instance().report(std::cout);
+
+	mgr.saveSnapshot();
+
 	for (auto&& ro : renderObjects)
 		ro->cleanUp(device);
 	renderObjects.clear();